@@ -20,10 +20,18 @@
 #include "application.hpp"
 #include "dialogabout.hpp"
 #include "dialogprefs.hpp"
+#if USE_X11_KEYS
+#include "globalkeys.hpp"
+#endif
+#if USE_HOOKS
+#include "hooks.hpp"
+#endif
 #include "menuvolume.hpp"
 #include "qtilities.hpp"
+#include "trayitem.hpp"
 
 #include "audio/device.hpp"
+#include "audio/engine.hpp"
 #if USE_ALSA
 #include "audio/device/alsa.hpp"
 #include "audio/engine/alsa.hpp"
@@ -31,38 +39,30 @@
 #if USE_PULSEAUDIO
 #include "audio/engine/pulseaudio.hpp"
 #endif
-
-#if QT_VERSION < 0x060000
-    #include <StatusNotifierItemQt5/statusnotifieritem.h>
-#else
-    #include <StatusNotifierItemQt6/statusnotifieritem.h>
+#if USE_ENGINE_HELPER
+#include "audio/engine/remote.hpp"
 #endif
 
 #include <QAction>
 #include <QIcon>
 #include <QLibraryInfo>
-#include <QMenu>
+#include <QPointer>
 #include <QProcess>
-#include <QToolTip>
-#include <QWheelEvent>
 
 #include <QDebug>
 
 Qtilities::Application::Application(int argc, char* argv[])
     : QApplication(argc, argv)
     , engine_(nullptr)
-    , channel_(nullptr)
+#if USE_HOOKS
+    , hooks_(nullptr)
+#endif
 {
     setOrganizationName(ORGANIZATION_NAME);
     setOrganizationDomain(ORGANIZATION_DOMAIN);
     setApplicationName(APPLICATION_NAME);
     setApplicationDisplayName(APPLICATION_DISPLAY_NAME);
 
-    trayIcon_ = new StatusNotifierItem(qApp->applicationName(), this);
-    trayIcon_->setCategory(StatusNotifierItem::SNICategory::ApplicationStatus);
-    trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
-    trayIcon_->setToolTipTitle(qApp->applicationDisplayName());
-
     setQuitOnLastWindowClosed(false);
 
     initLocale();
@@ -107,22 +107,6 @@ void Qtilities::Application::initUi()
     settings_.load();
 
     actAutoStart_ = new QAction(tr("Auto&start"), this);
-    mnuVolume_ = new MenuVolume;
-    mnuVolume_->loadSettings();
-    mnuVolume_->show(); // FIXME: crash without this
-    mnuVolume_->hide();
-
-    onAudioEngineChanged(settings_.engineId());
-    onAudioDeviceChanged(settings_.channelId());
-    updateDeviceList();
-    updateTrayIcon();
-
-    if(channel_) {
-        channel_->setMute(settings_.isMuted());
-        int volume = std::clamp(settings_.volume(), 0, 100);
-        channel_->setVolume(volume);
-        mnuVolume_->setVolume(channel_->volume());
-    }
     actAutoStart_->setCheckable(true);
     actAutoStart_->setChecked(settings_.useAutostart());
 
@@ -134,75 +118,119 @@ void Qtilities::Application::initUi()
     QAction *actQuit = new QAction(QIcon::fromTheme("application-exit", QIcon(":/application-exit")),
                                    tr("&Quit"), this);
 
-    QMenu* mnuActions = new QMenu(mnuVolume_);
-    mnuActions->addAction(actAutoStart_);
-    mnuActions->addAction(actPrefs);
-    mnuActions->addAction(actAbout);
-    mnuActions->addAction(actQuit);
+    const QList<QAction *> actions = {actAutoStart_, actPrefs, actAbout, actQuit};
 
-    trayIcon_->setContextMenu(mnuActions);
+    // Every tray item costs only its own icon and popup, engine and devices are shared
+    trayItems_.append(new TrayItem(applicationName(), actions, this));
+    for (int i = 0; i < settings_.extraDevices().count(); ++i)
+        trayItems_.append(new TrayItem(QStringLiteral("%1-%2").arg(applicationName()).arg(i + 1),
+                                       actions, this));
+#if USE_HOOKS
+    hooks_ = new Hooks(this);
+#endif
+
+    onAudioEngineChanged(settings_.engineId());
+    onAudioDeviceChanged(settings_.channelId());
+    updateDeviceList();
+
+    if (AudioDevice *channel = trayItems_.first()->device()) {
+        // The volume is restored once the mute state was applied
+        channel->setMuteNoCommit(settings_.isMuted());
+        channel->setVolumeNoCommit(std::clamp(settings_.volume(), 0, 100));
+
+        QPointer<AudioDevice> device(channel);
+        engine_->setMuteAsync(channel, settings_.isMuted())->andThen([device]() {
+            if (!device || !device->engine())
+                return AudioOperation::failed(QStringLiteral("Device removed"));
+            return device->engine()->commitDeviceVolumeAsync(device);
+        })->onCompleted([](const AudioOperation &op) {
+            if (!op.isFinished())
+                qWarning() << "Unable to restore the volume:" << op.errorString();
+        });
+    }
 
     connect(actAbout, &QAction::triggered, this, &Application::about);
     connect(actPrefs, &QAction::triggered, this, &Application::preferences);
     connect(actQuit, &QAction::triggered, this, &Application::quit);
 
-    connect(this, &QApplication::aboutToQuit, mnuVolume_, &QObject::deleteLater);
-    connect(this, &QApplication::aboutToQuit, trayIcon_, &QObject::deleteLater);
     connect(this, &QApplication::aboutToQuit, this, &Application::onAboutToQuit);
 
-    connect(mnuVolume_, &MenuVolume::sigRunMixer, this, &Application::runMixer);
-    connect(mnuVolume_, &MenuVolume::sigMuteToggled, this, [this](bool muted) {
-        if (!channel_)
-            return;
-
-        channel_->setMute(muted);
-        updateTrayIcon();
-    });
-    connect(mnuVolume_, &MenuVolume::sigVolumeChanged, this, &Application::onVolumeChanged);
-    connect(mnuVolume_, &QMenu::aboutToHide, this, [this]() {
-        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
-    });
-    connect(trayIcon_, &StatusNotifierItem::activateRequested, this, &Application::onActivateRequested);
-    connect(trayIcon_, &StatusNotifierItem::secondaryActivateRequested, this, &Application::onSecondaryActivateRequested);
-    connect(trayIcon_, &StatusNotifierItem::scrollRequested, this, &Application::onScrollRequested);
+    for (TrayItem *item : qAsConst(trayItems_)) {
+        connect(item, &TrayItem::sigRunMixer, this, &Application::runMixer);
+        connect(item, &TrayItem::sigDeviceReplaced, this, [this, item](AudioDevice *device) {
+            onDeviceReplaced(item, device);
+        });
+    }
+#if USE_X11_KEYS
+    // Media keys drive the primary item, through the same path as scrolling
+    GlobalKeys *globalKeys = new GlobalKeys(this);
+    if (globalKeys->isActive()) {
+        connect(globalKeys, &GlobalKeys::sigVolumeStep, trayItems_.first(), &TrayItem::stepVolume);
+        connect(globalKeys, &GlobalKeys::sigMuteToggled, trayItems_.first(), &TrayItem::toggleMute);
+    } else {
+        delete globalKeys;
+    }
+#endif
 }
 
 void Qtilities::Application::about()
 {
-    DialogAbout dlg(mnuVolume_);
+    DialogAbout dlg(trayItems_.first()->menu());
     centerOnScreen(&dlg);
     dlg.exec();
 }
 
 void Qtilities::Application::preferences()
 {
-    DialogPrefs prefs(mnuVolume_);
+    DialogPrefs prefs(trayItems_.first()->menu());
     prefs.setDeviceList(deviceList_);
     prefs.loadSettings();
 
     centerOnScreen(&prefs);
 
-    connect(&prefs, &QDialog::accepted, this, &Application::onPrefsChanged);
-    connect(engine_, &AudioEngine::sinkListChanged, this, [&prefs, this] {
-        updateDeviceList();
-        prefs.setDeviceList(deviceList_);
-    });
-    prefs.exec();
+    // Use the dialog as context so the connection goes away with it
+    if (engine_) {
+        connect(engine_, &AudioEngine::sinkListChanged, &prefs, [&prefs, this] {
+            updateDeviceList();
+            prefs.setDeviceList(deviceList_);
+        });
+    }
+    const Settings previous = settings_;
+    if (prefs.exec() == QDialog::Accepted)
+        onPrefsChanged(previous);
 }
 
-void Qtilities::Application::onPrefsChanged()
+void Qtilities::Application::onPrefsChanged(const Settings &previous)
 {
+    // Apply only what actually changed, unchanged bindings are left untouched
+    if (settings_.engineId() != previous.engineId()) {
+        onAudioEngineChanged(settings_.engineId());
+        onAudioDeviceChanged(settings_.channelId());
+        updateDeviceList();
+    } else {
+        if (engine_ && settings_.isNormalized() != previous.isNormalized()) {
+            engine_->setNormalized(settings_.isNormalized());
 #if USE_ALSA
-    engine_->setNormalized(settings_.isNormalized());
-    AlsaEngine* alsa = qobject_cast<AlsaEngine*>(engine_);
-    AlsaDevice* dev = qobject_cast<AlsaDevice*>(channel_);
-    if (alsa && dev)
-        alsa->updateDevice(dev);
+            // Re-read the volumes with the new curve
+            if (AlsaEngine* alsa = qobject_cast<AlsaEngine*>(engine_)) {
+                for (TrayItem *item : qAsConst(trayItems_)) {
+                    if (AlsaDevice* dev = qobject_cast<AlsaDevice*>(item->device()))
+                        alsa->updateDevice(dev);
+                }
+            }
 #endif
-    mnuVolume_->loadSettings();
+        }
+        if (settings_.channelId() != previous.channelId())
+            onAudioDeviceChanged(settings_.channelId());
+    }
+    if (settings_.volumeFeedback() != previous.volumeFeedback())
+        updateFeedback();
 
-    onAudioDeviceChanged(settings_.channelId());
-    onAudioEngineChanged(settings_.engineId());
+    if (settings_.pageStep() != previous.pageStep()
+        || settings_.singleStep() != previous.singleStep()) {
+        for (TrayItem *item : qAsConst(trayItems_))
+            item->menu()->loadSettings();
+    }
 }
 
 void Qtilities::Application::onAudioEngineChanged(int engineId)
@@ -211,30 +239,66 @@ void Qtilities::Application::onAudioEngineChanged(int engineId)
         if (engine_->id() == engineId)
             return;
 
-        if (channel_) {
-            disconnect(channel_, nullptr, this, nullptr);
-            channel_ = nullptr;
+        for (TrayItem *item : qAsConst(trayItems_)) {
+            if (item->device())
+                disconnect(item->device(), nullptr, this, nullptr);
+            item->setDevice(nullptr);
+        }
+        // Devices are owned by the engine and go away with it
+        engine_->deleteLater();
+        engine_ = nullptr;
+    }
+#if USE_ENGINE_HELPER
+    // Same engines, hosted by a separate process
+    if (settings_.useEngineHelper() && engineId >= 0 && engineId < EngineId::EngineMax) {
+        RemoteEngine* remote = new RemoteEngine(engineId, this);
+        if (remote->hasChannel()) {
+            engine_ = remote;
+            qInfo("Engine helper in use, card profiles, ports and the stream list are not available");
+        } else {
+            qWarning("Engine helper unavailable, using the in-process engine");
+            delete remote;
         }
     }
-    switch (engineId) {
+#endif
+    if (!engine_) {
+        switch (engineId) {
 #if USE_ALSA
-    case EngineId::Alsa:
-        engine_ = new AlsaEngine(this);
-        break;
+        case EngineId::Alsa:
+            engine_ = new AlsaEngine(this);
+            break;
 #endif
 #if USE_PULSEAUDIO
-    case EngineId::PulseAudio:
-        engine_ = new PulseAudioEngine(this);
-        break;
+        case EngineId::PulseAudio:
+            engine_ = new PulseAudioEngine(this);
+            break;
 #endif
-    default:
-        engine_ = nullptr;
-        return;
+        default:
+            onRecordingStreamsChanged(0);
+#if USE_HOOKS
+            hooks_->setEngine(nullptr);
+#endif
+            return;
+        }
     }
 #if 0
     engine_->setIgnoreMaxVolume(settings_.ignoreMaxVolume());
 #endif
     engine_->setNormalized(settings_.isNormalized());
+
+    // Extra devices may come and go (e.g. hotplugged PulseAudio sinks)
+    connect(engine_, &AudioEngine::sinkListChanged, this, &Application::bindExtraDevices);
+    connect(engine_, &AudioEngine::recordingStreamsChanged, this, &Application::onRecordingStreamsChanged);
+    onRecordingStreamsChanged(engine_->recordingStreams());
+#if USE_HOOKS
+    hooks_->setEngine(engine_);
+#endif
+}
+
+void Qtilities::Application::onRecordingStreamsChanged(int streams)
+{
+    for (TrayItem *item : qAsConst(trayItems_))
+        item->setRecording(streams);
 }
 
 void Qtilities::Application::onAudioDeviceChanged(int deviceId)
@@ -242,65 +306,75 @@ void Qtilities::Application::onAudioDeviceChanged(int deviceId)
     if (!engine_ || engine_->sinks().count() <= 0)
         return;
 
-    if (deviceId < 0)
+    if (deviceId < 0 || deviceId >= engine_->sinks().count())
         deviceId = 0;
 
-    channel_ = engine_->sinks().at(deviceId);
+    AudioDevice *channel = engine_->sinks().at(deviceId);
+    TrayItem *primary = trayItems_.first();
+    if (primary->device() == channel)
+        return;
+
+    if (primary->device())
+        disconnect(primary->device(), nullptr, this, nullptr);
+
+    primary->setDevice(channel);
 
-    connect(channel_, &AudioDevice::muteChanged, this, [this](bool muted) {
-        mnuVolume_->setMute(muted);
+    connect(channel, &AudioDevice::muteChanged, this, [this](bool muted) {
         settings_.setMuted(muted);
-        updateTrayIcon();
     });
-    connect(channel_, &AudioDevice::volumeChanged, this, &Application::onVolumeChanged);
+    connect(channel, &AudioDevice::volumeChanged, this, [this](int volume) {
+        settings_.setVolume(volume);
+    });
+    connect(channel, &AudioDevice::stateChanged, this, &Application::updateFeedback);
+    updateFeedback();
+    bindExtraDevices();
 }
 
-void Qtilities::Application::onVolumeChanged(int volume)
+// The feedback stream follows the primary device, kept ready only while the
+// device is active: an idle or suspended sink is not woken up for a click
+void Qtilities::Application::updateFeedback()
 {
-    if (!channel_)
+    if (!engine_)
         return;
 
-    channel_->setVolume(volume);
-    settings_.setVolume(volume);
-    updateTrayIcon();
+    AudioDevice *channel = trayItems_.first()->device();
+    if (channel && channel->isActive() && settings_.volumeFeedback())
+        engine_->openFeedback(channel);
+    else
+        engine_->closeFeedback();
 }
 
-void Qtilities::Application::onAboutToQuit()
+void Qtilities::Application::onDeviceReplaced(TrayItem *item, AudioDevice *device)
 {
-    settings_.setUseAutostart(actAutoStart_->isChecked());
-    settings_.useAutostart() ? createAutostartFile() : deleteAutostartFile();
-    settings_.save();
-}
+    if (!engine_)
+        return;
 
-void Qtilities::Application::onActivateRequested(const QPoint&)
-{
-    if (trayIcon_->status() == StatusNotifierItem::SNIStatus::Active) {
-        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
-        mnuVolume_->hide();
-    } else {
-        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Active);
-        mnuVolume_->show();
-        mnuVolume_->adjustSize();
-        mnuVolume_->popUp();
+    int i = trayItems_.indexOf(item);
+    if (i == 0) {
+        settings_.setChannelId(engine_->sinks().indexOf(device));
+        onAudioDeviceChanged(settings_.channelId());
+    } else if (i > 0) {
+        QStringList keys = settings_.extraDevices();
+        if (i - 1 < keys.count())
+            keys[i - 1] = device->key();
+        settings_.setExtraDevices(keys);
+        item->setDevice(device);
     }
+    updateDeviceList();
 }
 
-void Qtilities::Application::onSecondaryActivateRequested(const QPoint&)
+void Qtilities::Application::bindExtraDevices()
 {
-    if (channel_ && settings_.muteOnMiddleClick())
-        channel_->toggleMute();
+    const QStringList keys = settings_.extraDevices();
+    for (int i = 0; i < keys.count() && i + 1 < trayItems_.count(); ++i)
+        trayItems_.at(i + 1)->setDevice(engine_ ? engine_->sinkByKey(keys.at(i)) : nullptr);
 }
 
-void Qtilities::Application::onScrollRequested(int delta, Qt::Orientation)
+void Qtilities::Application::onAboutToQuit()
 {
-    if (!channel_)
-        return;
-    int v = std::clamp(channel_->volume() + delta / 120, 0, 100);
-    channel_->setVolume(v);
-    mnuVolume_->setVolume(v);
-//  trayIcon_->setToolTipTitle(QString("%1\%").arg(v));
-    QToolTip::showText(QCursor::pos(), QString("%1\%").arg(v));
-    QToolTip::hideText();
+    settings_.setUseAutostart(actAutoStart_->isChecked());
+    settings_.useAutostart() ? createAutostartFile() : deleteAutostartFile();
+    settings_.save();
 }
 
 void Qtilities::Application::runMixer()
@@ -326,31 +400,3 @@ void Qtilities::Application::updateDeviceList()
     for (const AudioDevice *dev : engine_->sinks())
         deviceList_.append(dev->description());
 }
-
-void Qtilities::Application::updateTrayIcon()
-{
-    if (!channel_)
-        return;
-    QString iconName;
-    int volume = channel_->volume();
-    if (volume <= 0 || channel_->mute())
-        iconName = QLatin1String("audio-volume-muted");
-    else if (volume <= 33)
-        iconName = QLatin1String("audio-volume-low");
-    else if (volume <= 66)
-        iconName = QLatin1String("audio-volume-medium");
-    else
-        iconName = QLatin1String("audio-volume-high");
-
-    trayIcon_->setIconByName(iconName);
-}
-
-int main(int argc, char* argv[])
-{
-    // UseHighDpiPixmaps is default from Qt6
-#if QT_VERSION < 0x060000
-    QGuiApplication::setAttribute(Qt::AA_UseHighDpiPixmaps, true);
-#endif
-    Qtilities::Application app(argc, argv);
-    return app.exec();
-}
@@ -26,7 +26,7 @@
 
 class AudioDevice;
 class AudioEngine;
-class StatusNotifierItem;
+class TestPreferences;
 
 QT_BEGIN_NAMESPACE
 class QAction;
@@ -34,10 +34,12 @@ QT_END_NAMESPACE
 
 namespace Qtilities {
 
-class MenuVolume;
+class Hooks;
+class TrayItem;
 class Application : public QApplication
 {
     Q_OBJECT
+    friend class ::TestPreferences;
 
 public:
     Application(int argc, char *argv[]);
@@ -50,26 +52,26 @@ private:
     void initUi();
 
     void runMixer();
+    void bindExtraDevices();
+    void onRecordingStreamsChanged(int);
+    void updateFeedback();
     void updateDeviceList();
-    void updateTrayIcon();
 
     void onAboutToQuit();
     void onAudioDeviceChanged(int);
     void onAudioEngineChanged(int);
-    void onPrefsChanged();
-    void onActivateRequested(const QPoint&);
-    void onSecondaryActivateRequested(const QPoint&);
-    void onScrollRequested(int delta, Qt::Orientation);
-
-    void onVolumeChanged(int);
+    void onPrefsChanged(const Settings &previous);
+    void onDeviceReplaced(TrayItem *, AudioDevice *);
 
     QStringList deviceList_;
     QTranslator qtTranslator_, translator_;
     Settings settings_;
-    StatusNotifierItem *trayIcon_;
     QAction *actAutoStart_;
-    MenuVolume *mnuVolume_;
+    // The first item is bound to the ChannelId device, the others to ExtraDevices keys
+    QList<TrayItem *> trayItems_;
     AudioEngine *engine_;
-    AudioDevice *channel_;
+#if USE_HOOKS
+    Hooks *hooks_;
+#endif
 };
 } // namespace Qtilities
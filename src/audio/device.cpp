@@ -35,7 +35,19 @@ AudioDevice::AudioDevice(AudioDeviceType t, AudioEngine* engine, QObject* parent
     , m_mute(false)
     , m_type(t)
     , m_index(0)
+    , m_state(Unknown)
+    , m_bound(true)
 {
+    if (m_engine) {
+        connect(this, &AudioDevice::volumeChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::muteChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::nameChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::descriptionChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::indexChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::stateChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::boundChanged, m_engine, &AudioEngine::invalidateSnapshot);
+        connect(this, &AudioDevice::healthChanged, m_engine, &AudioEngine::invalidateSnapshot);
+    }
 }
 
 AudioDevice::~AudioDevice() = default;
@@ -67,6 +79,30 @@ void AudioDevice::setIndex(uint index)
     emit indexChanged(index);
 }
 
+void AudioDevice::setState(State state)
+{
+    if (m_state == state)
+        return;
+
+    m_state = state;
+    emit stateChanged(m_state);
+}
+
+void AudioDevice::setBound(bool bound)
+{
+    if (m_bound == bound)
+        return;
+
+    m_bound = bound;
+    emit boundChanged(m_bound);
+}
+
+void AudioDevice::recordHealth(const AudioHealthSample& sample)
+{
+    m_health.record(sample);
+    emit healthChanged();
+}
+
 // this is just for setting the internal volume
 void AudioDevice::setVolumeNoCommit(int volume)
 {
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include "audio/health.hpp"
+
 #include <QObject>
 
 class AudioEngine;
@@ -41,8 +43,21 @@ class AudioDevice : public QObject {
     Q_OBJECT
     Q_PROPERTY(int volume READ volume WRITE setVolume NOTIFY volumeChanged)
     Q_PROPERTY(AudioDeviceType type READ type CONSTANT)
+    Q_PROPERTY(State state READ state NOTIFY stateChanged)
+    Q_PROPERTY(bool bound READ isBound NOTIFY boundChanged)
+    Q_PROPERTY(quint64 latency READ latency NOTIFY healthChanged)
+    Q_PROPERTY(quint32 xruns READ xruns NOTIFY healthChanged)
 
 public:
+    // Processing state, engines unable to tell leave it Unknown
+    enum State {
+        Unknown,
+        Running,
+        Idle,
+        Suspended
+    };
+    Q_ENUM(State)
+
     AudioDevice(AudioDeviceType t, AudioEngine* engine, QObject* parent = nullptr);
     ~AudioDevice();
 
@@ -53,10 +68,24 @@ public:
     const QString& name() const { return m_name; }
     const QString& description() const { return m_description; }
     uint index() const { return m_index; }
+    State state() const { return m_state; }
+    // Whether audio flows, features costing CPU skip idle or suspended devices
+    bool isActive() const { return m_state == Running || m_state == Unknown; }
+    // False until the engine read the device, volume and mute mean nothing
+    // before, e.g. devices of deferred ALSA cards not used yet
+    bool isBound() const { return m_bound; }
+    const AudioHealth& health() const { return m_health; }
+    quint64 latency() const { return m_health.isEmpty() ? 0 : m_health.last().latency; }
+    quint32 xruns() const { return m_health.isEmpty() ? 0 : m_health.last().xruns; }
+    // stable identifier used to bind a tray item to this device across restarts
+    virtual QString key() const { return m_name; }
 
     void setName(const QString& name);
     void setDescription(const QString& description);
     void setIndex(uint index);
+    void setState(State state);
+    void setBound(bool bound);
+    void recordHealth(const AudioHealthSample& sample);
 
     AudioEngine* engine() { return m_engine; }
 
@@ -74,6 +103,9 @@ signals:
     void nameChanged(const QString& name);
     void descriptionChanged(const QString& description);
     void indexChanged(uint index);
+    void stateChanged(State state);
+    void boundChanged(bool bound);
+    void healthChanged();
 
 private:
     AudioEngine* m_engine;
@@ -83,4 +115,7 @@ private:
     QString m_name;
     uint m_index;
     QString m_description;
+    State m_state;
+    bool m_bound;
+    AudioHealth m_health;
 };
@@ -31,6 +31,7 @@ AlsaDevice::AlsaDevice(AudioDeviceType t, AudioEngine* engine, QObject* parent)
     : AudioDevice(t, engine, parent)
     , m_mixer(nullptr)
     , m_elem(nullptr)
+    , m_elementIndex(0)
     , m_volumeMin(0)
     , m_volumeMax(100)
 {
@@ -51,9 +52,24 @@ void AlsaDevice::setElement(snd_mixer_elem_t* elem)
         return;
 
     m_elem = elem;
+    if (m_elem)
+        m_elementIndex = snd_mixer_selem_get_index(m_elem);
     emit elementChanged();
 }
 
+QString AlsaDevice::key() const
+{
+    return makeKey(m_cardName, name(), m_elementIndex);
+}
+
+QString AlsaDevice::makeKey(const QString& cardName, const QString& name, uint index)
+{
+    QString key = cardName + QLatin1Char(':') + name;
+    if (index > 0)
+        key += QLatin1Char(',') + QString::number(index);
+    return key;
+}
+
 void AlsaDevice::setCardName(const QString& cardName)
 {
     if (m_cardName == cardName)
@@ -68,3 +84,14 @@ void AlsaDevice::setVolumeMinMax(long volumeMin, long volumeMax)
     m_volumeMin = volumeMin;
     m_volumeMax = volumeMax;
 }
+
+AlsaChainedDevice::AlsaChainedDevice(AudioEngine* engine, QObject* parent)
+    : AlsaDevice(Sink, engine, parent)
+{
+}
+
+void AlsaChainedDevice::setElements(const QList<snd_mixer_elem_t*>& elements)
+{
+    m_elements = elements;
+    setElement(m_elements.value(0));
+}
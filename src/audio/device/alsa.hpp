@@ -31,6 +31,7 @@
 
 #include <alsa/asoundlib.h>
 
+#include <QList>
 #include <QObject>
 #include <QString>
 
@@ -45,10 +46,17 @@ public:
     const QString& cardName() const { return m_cardName; }
     inline long volumeMin() const { return m_volumeMin; }
     inline long volumeMax() const { return m_volumeMax; }
+    // simple element index, elements may share a name, e.g. "Headphone",1
+    uint elementIndex() const { return m_elementIndex; }
+    // element names are only unique within a card, e.g. "hw:0:Master" or "hw:0:Headphone,1"
+    QString key() const override;
+    // the same key, for elements without a device yet
+    static QString makeKey(const QString& cardName, const QString& name, uint index);
 
     void setMixer(snd_mixer_t* mixer);
     void setElement(snd_mixer_elem_t* elem);
     void setCardName(const QString& cardName);
+    void setElementIndex(uint index) { m_elementIndex = index; }
     void setVolumeMinMax(long volumeMin, long volumeMax);
 
 signals:
@@ -60,6 +68,23 @@ private:
     snd_mixer_t* m_mixer;
     snd_mixer_elem_t* m_elem;
     QString m_cardName;
+    uint m_elementIndex;
     long m_volumeMin;
     long m_volumeMax;
 };
+
+// Several elements of one card driven as a single dB axis, e.g. Master, PCM
+// and Headphone, which are serial stages of the same output path
+class AlsaChainedDevice : public AlsaDevice {
+    Q_OBJECT
+
+public:
+    AlsaChainedDevice(AudioEngine* engine, QObject* parent = nullptr);
+
+    const QList<snd_mixer_elem_t*>& elements() const { return m_elements; }
+    bool contains(snd_mixer_elem_t* elem) const { return m_elements.contains(elem); }
+    void setElements(const QList<snd_mixer_elem_t*>& elements);
+
+private:
+    QList<snd_mixer_elem_t*> m_elements;
+};
@@ -0,0 +1,118 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/dispatcher.hpp"
+
+#include <QCoreApplication>
+
+AudioDispatcher* AudioDispatcher::m_instance = nullptr;
+
+AudioDispatcher::AudioDispatcher(QObject* parent)
+    : QObject(parent)
+    , m_backendBudget(4)
+    , m_coalesced(0)
+{
+    // zero timers fire once pending input has been dispatched
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(0);
+    connect(&m_timer, &QTimer::timeout, this, &AudioDispatcher::processTurn);
+}
+
+AudioDispatcher* AudioDispatcher::instance()
+{
+    if (!m_instance)
+        m_instance = new AudioDispatcher(QCoreApplication::instance());
+
+    return m_instance;
+}
+
+void AudioDispatcher::post(Priority priority, Task task)
+{
+    enqueue(priority, nullptr, 0, std::move(task));
+}
+
+void AudioDispatcher::post(Priority priority, const void* owner, quint64 id, Task task)
+{
+    enqueue(priority, owner, id, std::move(task));
+}
+
+void AudioDispatcher::setBackendBudget(int tasksPerTurn)
+{
+    m_backendBudget = qMax(1, tasksPerTurn);
+}
+
+void AudioDispatcher::enqueue(Priority priority, const void* owner, quint64 id, Task task)
+{
+    Lane& lane = m_lanes[priority];
+    Key key(reinterpret_cast<quintptr>(owner), id);
+
+    if (owner) {
+        auto it = lane.pending.constFind(key);
+        if (it != lane.pending.constEnd()) {
+            // keep the queue position, only the latest request matters
+            **it = std::move(task);
+            ++m_coalesced;
+            return;
+        }
+    }
+    std::shared_ptr<Task> entry = std::make_shared<Task>(std::move(task));
+    if (owner)
+        lane.pending.insert(key, entry);
+
+    lane.queue.push_back(Entry { key, entry });
+
+    if (!m_timer.isActive())
+        m_timer.start();
+}
+
+bool AudioDispatcher::runNext(Priority priority)
+{
+    Lane& lane = m_lanes[priority];
+    if (lane.queue.empty())
+        return false;
+
+    Entry entry = std::move(lane.queue.front());
+    lane.queue.pop_front();
+
+    auto it = lane.pending.find(entry.key);
+    if (it != lane.pending.end() && *it == entry.task)
+        lane.pending.erase(it);
+
+    (*entry.task)();
+    return true;
+}
+
+void AudioDispatcher::processTurn()
+{
+    while (runNext(UserIntent)) { }
+
+    for (int budget = m_backendBudget; budget > 0; --budget) {
+        if (!runNext(Backend))
+            break;
+    }
+    // views run last so they show the state left by this turn
+    while (runNext(View)) { }
+
+    for (const Lane& lane : m_lanes) {
+        if (!lane.queue.empty()) {
+            m_timer.start();
+            break;
+        }
+    }
+}
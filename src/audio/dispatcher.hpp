@@ -0,0 +1,78 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QPair>
+#include <QTimer>
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+// Runs GUI thread work by priority, one batch per event loop turn:
+// every pending user intent first, then at most backendBudget() backend
+// updates, then view refreshes. Input events are handled between turns,
+// so user latency stays bounded however many backend events pile up.
+class AudioDispatcher : public QObject {
+    Q_OBJECT
+
+public:
+    enum Priority {
+        UserIntent,
+        Backend,
+        View,
+        PriorityCount
+    };
+    using Task = std::function<void()>;
+
+    static AudioDispatcher* instance();
+
+    void post(Priority priority, Task task);
+    // A task still pending for the same owner and id is replaced in place
+    void post(Priority priority, const void* owner, quint64 id, Task task);
+
+    int backendBudget() const { return m_backendBudget; }
+    void setBackendBudget(int tasksPerTurn);
+    quint64 coalesced() const { return m_coalesced; }
+
+private:
+    AudioDispatcher(QObject* parent = nullptr);
+    void enqueue(Priority priority, const void* owner, quint64 id, Task task);
+    bool runNext(Priority priority);
+    void processTurn();
+
+    using Key = QPair<quintptr, quint64>;
+    struct Entry {
+        Key key;
+        std::shared_ptr<Task> task;
+    };
+    struct Lane {
+        std::deque<Entry> queue;
+        QHash<Key, std::shared_ptr<Task>> pending;
+    };
+
+    Lane m_lanes[PriorityCount];
+    QTimer m_timer;
+    int m_backendBudget;
+    quint64 m_coalesced;
+    static AudioDispatcher* m_instance;
+};
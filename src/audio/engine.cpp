@@ -27,14 +27,21 @@
 
 #include "audio/engine.hpp"
 #include "audio/device.hpp"
+#include "audio/dispatcher.hpp"
 
 #include <QMetaType>
+#include <QPointer>
 #include <QtDebug>
 
 AudioEngine::AudioEngine(QObject* parent)
     : QObject(parent)
     , m_isNormalized(false)
+    , m_snapshot(std::make_shared<const AudioSnapshot>())
+    , m_generation(0)
 {
+    connect(this, &AudioEngine::sinkListChanged, this, &AudioEngine::invalidateSnapshot);
+    // the first one once the derived engine discovered its devices
+    invalidateSnapshot();
 }
 
 AudioEngine::~AudioEngine()
@@ -43,6 +50,61 @@ AudioEngine::~AudioEngine()
     m_sinks.clear();
 }
 
+AudioSnapshotPtr AudioEngine::snapshot() const
+{
+#if defined(__cpp_lib_atomic_shared_ptr)
+    return m_snapshot.load();
+#else
+    return std::atomic_load(&m_snapshot);
+#endif
+}
+
+// Any number of changes within a dispatcher turn end up in one snapshot
+void AudioEngine::invalidateSnapshot()
+{
+    QPointer<AudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::View, &m_snapshot, 0, [self]() {
+        if (self)
+            self->publishSnapshot();
+    });
+}
+
+void AudioEngine::publishSnapshot()
+{
+    auto snapshot = std::make_shared<AudioSnapshot>();
+    snapshot->generation = ++m_generation;
+    snapshot->engineId = id();
+    snapshot->sinks.reserve(m_sinks.count());
+    for (const AudioDevice* dev : qAsConst(m_sinks)) {
+        AudioDeviceSnapshot device;
+        device.key = dev->key();
+        device.name = dev->name();
+        device.description = dev->description();
+        device.index = dev->index();
+        device.volume = dev->volume();
+        device.mute = dev->mute();
+        device.state = dev->state();
+        device.bound = dev->isBound();
+        device.latency = dev->latency();
+        device.xruns = dev->xruns();
+        snapshot->sinks.append(device);
+    }
+#if defined(__cpp_lib_atomic_shared_ptr)
+    m_snapshot.store(std::move(snapshot));
+#else
+    std::atomic_store(&m_snapshot, AudioSnapshotPtr(std::move(snapshot)));
+#endif
+}
+
+AudioDevice* AudioEngine::sinkByKey(const QString& key) const
+{
+    for (AudioDevice* dev : m_sinks) {
+        if (dev->key() == key)
+            return dev;
+    }
+    return nullptr;
+}
+
 int AudioEngine::volumeBounded(int volume, AudioDevice* device) const
 {
     int maximum = volumeMax(device);
@@ -51,6 +113,18 @@ int AudioEngine::volumeBounded(int volume, AudioDevice* device) const
     return qRound((bounded / maximum) * 100);
 }
 
+AudioOperationPtr AudioEngine::commitDeviceVolumeAsync(AudioDevice* device)
+{
+    commitDeviceVolume(device);
+    return AudioOperation::finished();
+}
+
+AudioOperationPtr AudioEngine::setMuteAsync(AudioDevice* device, bool state)
+{
+    setMute(device, state);
+    return AudioOperation::finished();
+}
+
 void AudioEngine::mute(AudioDevice* device)
 {
     setMute(device, true);
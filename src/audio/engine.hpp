@@ -28,11 +28,16 @@
 #pragma once
 
 #include "audio/engineid.hpp"
+#include "audio/operation.hpp"
+#include "audio/snapshot.hpp"
 
 #include <QObject>
 #include <QList>
 #include <QTimer>
 
+#include <atomic>
+#include <memory>
+
 class AudioDevice;
 
 class AudioEngine : public QObject {
@@ -43,11 +48,32 @@ public:
     ~AudioEngine();
 
     const QList<AudioDevice*>& sinks() const { return m_sinks; }
+    // Thread safe, unlike everything else here. Not lock free: the pointer
+    // swap goes through a short spinlock inside the standard library, taken
+    // only for the copy of the pointer, never while a snapshot is built.
+    AudioSnapshotPtr snapshot() const;
+    AudioDevice* sinkByKey(const QString& key) const;
     virtual int volumeMax(AudioDevice* device) const = 0;
     virtual int volumeBounded(int volume, AudioDevice* device) const;
     virtual int id() const = 0;
     virtual bool isNormalized() const;
     virtual void setNormalized(bool) = 0;
+    // Streams currently recording from any source, engines unable to tell return 0
+    virtual int recordingStreams() const { return 0; }
+
+    // Called before a device is shown, engines may defer reading it until then
+    virtual void useDevice(AudioDevice*) { }
+
+    // Asynchronous counterparts of commitDeviceVolume() and setMute():
+    // the returned operation completes once the backend applied the change.
+    virtual AudioOperationPtr commitDeviceVolumeAsync(AudioDevice* device);
+    virtual AudioOperationPtr setMuteAsync(AudioDevice* device, bool state);
+
+    // Click feedback on volume steps: the stream is opened once on device and
+    // kept ready, playing restarts the click instead of queueing another one.
+    virtual void openFeedback(AudioDevice*) { }
+    virtual void closeFeedback() { }
+    virtual void playFeedback(AudioDevice*) { }
 
 public slots:
     virtual void commitDeviceVolume(AudioDevice* device) = 0;
@@ -55,11 +81,24 @@ public slots:
     void mute(AudioDevice* device);
     void unmute(AudioDevice* device);
     virtual void setIgnoreMaxVolume(bool ignore);
+    // Schedules a new snapshot once the current dispatcher batch ran
+    void invalidateSnapshot();
 
 signals:
     void sinkListChanged();
+    void recordingStreamsChanged(int count);
 
 protected:
     QList<AudioDevice*> m_sinks;
     bool m_isNormalized;
+
+private:
+    void publishSnapshot();
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<AudioSnapshotPtr> m_snapshot;
+#else
+    AudioSnapshotPtr m_snapshot; // only accessed through std::atomic_load/store, which lock
+#endif
+    quint64 m_generation;
 };
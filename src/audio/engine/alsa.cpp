@@ -27,8 +27,14 @@
 
 #include "audio/engine/alsa.hpp"
 #include "audio/device/alsa.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/feedback.hpp"
 
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
 #include <QMetaType>
+#include <QPointer>
 #include <QSocketNotifier>
 #include <QtDebug>
 
@@ -39,22 +45,222 @@ AlsaEngine* AlsaEngine::m_instance = nullptr;
 static int alsa_elem_event_callback(snd_mixer_elem_t* elem, unsigned int /*mask*/)
 {
     AlsaEngine* engine = AlsaEngine::instance();
-    if (engine)
+    if (engine) {
         engine->updateDevice(engine->getDeviceByAlsaElem(elem));
+        engine->invalidateChains(elem);
+    }
 
     return 0;
 }
 
+// Sum of the dB range of elems, in 0.01 dB, a stage without dB range makes it fail
+static bool chainRange(const QList<snd_mixer_elem_t*>& elems, long* min, long* max)
+{
+    *min = *max = 0;
+    for (snd_mixer_elem_t* elem : elems) {
+        long elemMin, elemMax;
+        if (snd_mixer_selem_get_playback_dB_range(elem, &elemMin, &elemMax) < 0 || elemMin >= elemMax)
+            return false;
+        *min += elemMin;
+        *max += elemMax;
+    }
+    return true;
+}
+
+// See https://github.com/alsa-project/alsa-utils/blob/master/alsamixer/volume_mapping.c
+// A dB value as a 0 to 100 volume following the perceived loudness
+static double normalizedVolume(long value, long min, long max)
+{
+    double volume = pow(10, (value - max) / 6000.0);
+    if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
+        double minNorm = pow(10, (min - max) / 6000.0);
+        volume = (volume - minNorm) / (1 - minNorm);
+    }
+    return volume * 100.0;
+}
+
+// and back, volume from 0 to 1
+static long normalizedDb(double volume, long min, long max)
+{
+    if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
+        double minNorm = pow(10, (min - max) / 6000.0);
+        volume = volume * (1 - minNorm) + minNorm;
+    }
+    if (volume <= 0)
+        return min;
+
+    return lrint(6000.0 * log10(volume)) + max;
+}
+
+// A mixer control of the given type, e.g. "Master Playback Volume",1
+static bool findControl(snd_ctl_t* ctl, const QString& name, uint index, snd_ctl_elem_type_t type,
+                        snd_ctl_elem_info_t* info)
+{
+    snd_ctl_elem_id_t* id;
+    snd_ctl_elem_id_alloca(&id);
+    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+    snd_ctl_elem_id_set_name(id, name.toLatin1().constData());
+    snd_ctl_elem_id_set_index(id, index);
+    snd_ctl_elem_info_set_id(info, id);
+    return snd_ctl_elem_info(ctl, info) >= 0 && snd_ctl_elem_info_get_type(info) == type;
+}
+
+static QVector<unsigned int> readTlv(snd_ctl_t* ctl, snd_ctl_elem_info_t* info)
+{
+    QVector<unsigned int> tlv;
+    if (!snd_ctl_elem_info_is_tlv_readable(info))
+        return tlv;
+
+    snd_ctl_elem_id_t* id;
+    snd_ctl_elem_id_alloca(&id);
+    snd_ctl_elem_info_get_id(info, id);
+    tlv.resize(64);
+    if (snd_ctl_elem_tlv_read(ctl, id, tlv.data(), tlv.size() * sizeof(unsigned int)) < 0)
+        tlv.clear();
+    return tlv;
+}
+
+// The dB part of a control TLV, nullptr without
+static unsigned int* dbInfo(QVector<unsigned int>& tlv)
+{
+    unsigned int* db = nullptr;
+    if (tlv.isEmpty() || snd_tlv_parse_dB_info(tlv.data(), tlv.size() * sizeof(unsigned int), &db) <= 0)
+        return nullptr;
+    return db;
+}
+
+// Same test as findChainStage(), without loading the mixer
+static bool hasDbVolume(snd_ctl_t* ctl, const char* name)
+{
+    snd_ctl_elem_info_t* info;
+    snd_ctl_elem_info_alloca(&info);
+    if (!findControl(ctl, QString::fromLatin1(name) + QLatin1String(" Playback Volume"), 0,
+                     SND_CTL_ELEM_TYPE_INTEGER, info))
+        return false;
+
+    QVector<unsigned int> tlv = readTlv(ctl, info);
+    unsigned int* db = dbInfo(tlv);
+    long min, max;
+    return db
+        && snd_tlv_get_dB_range(db, snd_ctl_elem_info_get_min(info), snd_ctl_elem_info_get_max(info), &min, &max) >= 0
+        && min < max;
+}
+
+static snd_mixer_elem_t* findChainStage(snd_mixer_t* mixer, const char* name)
+{
+    snd_mixer_selem_id_t* sid;
+    snd_mixer_selem_id_alloca(&sid);
+    snd_mixer_selem_id_set_name(sid, name);
+    snd_mixer_elem_t* elem = snd_mixer_find_selem(mixer, sid);
+    long min, max;
+    if (!elem || !snd_mixer_selem_has_playback_volume(elem)
+        || snd_mixer_selem_get_playback_dB_range(elem, &min, &max) < 0 || min >= max)
+        return nullptr;
+    return elem;
+}
+
+// Serial stages of the usual HDA output paths, one path per output element
+template <typename HasStage>
+static QList<QStringList> chainPaths(HasStage hasStage)
+{
+    QStringList stages;
+    for (const char* name : { "Master", "PCM" }) {
+        if (hasStage(name))
+            stages.append(QString::fromLatin1(name));
+    }
+    QList<QStringList> paths;
+    for (const char* name : { "Headphone", "Speaker" }) {
+        if (hasStage(name))
+            paths.append(stages + QStringList { QString::fromLatin1(name) });
+    }
+    if (paths.isEmpty())
+        paths.append(stages);
+
+    // a single stage is a device already
+    QList<QStringList> chains;
+    for (const QStringList& path : qAsConst(paths)) {
+        if (path.count() >= 2)
+            chains.append(path);
+    }
+    return chains;
+}
+
 static int alsa_mixer_event_callback(snd_mixer_t* /*mixer*/, unsigned int /*mask*/, snd_mixer_elem_t* /*elem*/)
 {
     return 0;
 }
 
+// Reads the playback substreams status of a card from procfs: a handful of
+// small text files, cheap enough to sample at a slow rate.
+// xruns gets the substreams found in XRUN state, e.g. "pcm0p/sub0".
+// Returns false if no playback substream is open.
+static bool readPcmStatus(int card, AudioHealthSample* sample, QSet<QString>* xruns)
+{
+    QDir cardDir(QStringLiteral("/proc/asound/card%1").arg(card));
+    const QStringList pcms = cardDir.entryList({ QStringLiteral("pcm*p") }, QDir::Dirs);
+    bool found = false;
+    xruns->clear();
+
+    for (const QString& pcm : pcms) {
+        QDir pcmDir(cardDir.filePath(pcm));
+        const QStringList subs = pcmDir.entryList({ QStringLiteral("sub*") }, QDir::Dirs);
+
+        for (const QString& sub : subs) {
+            QMap<QByteArray, QByteArray> values;
+            for (const char* name : { "status", "hw_params" }) {
+                QFile file(pcmDir.filePath(sub + QLatin1Char('/') + QLatin1String(name)));
+                if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+                    continue;
+                // "closed" or "key: value" lines
+                const QList<QByteArray> lines = file.readAll().split('\n');
+                for (const QByteArray& line : lines) {
+                    int colon = line.indexOf(':');
+                    if (colon > 0)
+                        values.insert(line.left(colon).trimmed(), line.mid(colon + 1).trimmed());
+                }
+            }
+            const QByteArray state = values.value("state");
+            if (state.isEmpty())
+                continue;
+
+            found = true;
+            if (state == "XRUN")
+                xruns->insert(pcm + QLatin1Char('/') + sub);
+
+            // e.g. "rate: 48000 (48000/1)"
+            quint64 rate = values.value("rate").split(' ').value(0).toULongLong();
+            if (rate == 0)
+                continue;
+
+            quint64 delay = values.value("delay").toULongLong();
+            quint64 bufferSize = values.value("buffer_size").toULongLong();
+            sample->latency = qMax(sample->latency, delay * 1000000 / rate);
+            sample->configuredLatency = qMax(sample->configuredLatency, bufferSize * 1000000 / rate);
+        }
+    }
+    return found;
+}
+
 AlsaEngine::AlsaEngine(QObject* parent)
     : AudioEngine(parent)
+    , m_feedbackPcm(nullptr)
+    , m_feedbackFrames(0)
 {
     discoverDevices();
     m_instance = this;
+
+    // the mixer API has no PCM status events, so sample slowly
+    m_healthTimer.setInterval(10000);
+    connect(&m_healthTimer, &QTimer::timeout, this, &AlsaEngine::sampleHealth);
+    if (!m_sinks.isEmpty())
+        m_healthTimer.start();
+}
+
+AlsaEngine::~AlsaEngine()
+{
+    closeFeedback();
+    for (const DeferredCard& card : qAsConst(m_deferredCards))
+        snd_ctl_close(card.ctl);
 }
 
 AlsaEngine* AlsaEngine::instance()
@@ -83,47 +289,163 @@ AlsaDevice* AlsaEngine::getDeviceByAlsaElem(snd_mixer_elem_t* elem) const
     return nullptr;
 }
 
+void AlsaEngine::invalidateChains(snd_mixer_elem_t* elem)
+{
+    for (AlsaChainedDevice* chain : qAsConst(m_chains)) {
+        if (chain->contains(elem))
+            m_dirtyChains.insert(chain);
+    }
+}
+
 void AlsaEngine::commitDeviceVolume(AudioDevice* device)
 {
+    commitDeviceVolumeAsync(device);
+}
+
+void AlsaEngine::setMute(AudioDevice* device, bool state)
+{
+    setMuteAsync(device, state);
+}
+
+// ALSA mixer writes are synchronous, operations are returned already completed
+AudioOperationPtr AlsaEngine::commitDeviceVolumeAsync(AudioDevice* device)
+{
+    if (AlsaChainedDevice* chain = qobject_cast<AlsaChainedDevice*>(device))
+        return commitChainVolume(chain);
+
     AlsaDevice* dev = qobject_cast<AlsaDevice*>(device);
-    snd_mixer_elem_t* elem = dev->element();
+    if (dev && !dev->element() && dev->isBound())
+        return commitCtlVolume(dev);
 
-    if (!dev || !elem)
-        return;
+    if (!dev || !dev->element())
+        return AudioOperation::failed(QStringLiteral("Invalid ALSA device"));
+
+    snd_mixer_elem_t* elem = dev->element();
+    int error;
 
-    // See https://github.com/alsa-project/alsa-utils/blob/master/alsamixer/volume_mapping.c#L120
     double volume = static_cast<double>(dev->volume()) / 100.0;
     long min, max, val;
 
     if (m_isNormalized) {
         snd_mixer_selem_get_playback_dB_range(elem, &min, &max);
-
-        if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
-            double minNorm = pow(10, (min - max) / 6000.0);
-            volume = volume * (1 - minNorm) + minNorm;
-        }
-        val = lrint(6000.0 * log10(volume)) + max;
-        snd_mixer_selem_set_playback_dB_all(elem, val, 0);
+        val = normalizedDb(volume, min, max);
+        error = snd_mixer_selem_set_playback_dB_all(elem, val, 0);
     } else {
         min = dev->volumeMin();
         max = dev->volumeMax();
         val = lrint(volume * (max - min)) + min;
-        snd_mixer_selem_set_playback_volume_all(elem, val);
+        error = snd_mixer_selem_set_playback_volume_all(elem, val);
     }
     qDebug() << "value: " << val;
     qDebug() << "volume: " << volume;
+
+    if (error < 0)
+        return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+
+    return AudioOperation::finished();
 }
 
-void AlsaEngine::setMute(AudioDevice* device, bool state)
+AudioOperationPtr AlsaEngine::setMuteAsync(AudioDevice* device, bool state)
 {
+    if (AlsaChainedDevice* chain = qobject_cast<AlsaChainedDevice*>(device))
+        return setChainMute(chain, state);
+
     AlsaDevice* dev = qobject_cast<AlsaDevice*>(device);
+    if (dev && !dev->element() && dev->isBound())
+        return setCtlMute(dev, state);
+
     if (!dev || !dev->element())
+        return AudioOperation::failed(QStringLiteral("Invalid ALSA device"));
+
+    if (snd_mixer_selem_has_playback_switch(dev->element())) {
+        int error = snd_mixer_selem_set_playback_switch_all(dev->element(), (int)!state);
+        if (error < 0)
+            return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+    } else if (state) {
+        dev->setVolumeNoCommit(0);
+        return commitDeviceVolumeAsync(dev);
+    }
+    return AudioOperation::finished();
+}
+
+// The combined range is mapped the same way as a normalized single element.
+// The attenuation goes to the first stages: each one takes what the stages
+// after it can't cover, and its rounding error is carried over to the next.
+AudioOperationPtr AlsaEngine::commitChainVolume(AlsaChainedDevice* chain)
+{
+    const QList<snd_mixer_elem_t*>& elems = chain->elements();
+    long min, max;
+    if (!chainRange(elems, &min, &max))
+        return AudioOperation::failed(QStringLiteral("Invalid ALSA chain"));
+
+    double volume = static_cast<double>(chain->volume()) / 100.0;
+    double minNorm = pow(10, (min - max) / 6000.0);
+    volume = volume * (1 - minNorm) + minNorm;
+    long remaining = volume > 0 ? lrint(6000.0 * log10(volume)) + max : min;
+
+    long laterMax = max;
+    for (snd_mixer_elem_t* elem : elems) {
+        long elemMin, elemMax;
+        snd_mixer_selem_get_playback_dB_range(elem, &elemMin, &elemMax);
+        laterMax -= elemMax;
+
+        long value = qBound(elemMin, remaining - laterMax, elemMax);
+        int error = snd_mixer_selem_set_playback_dB_all(elem, value, 1);
+        if (error < 0)
+            return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+
+        snd_mixer_selem_get_playback_dB(elem, static_cast<snd_mixer_selem_channel_id_t>(0), &value);
+        remaining -= value;
+    }
+    return AudioOperation::finished();
+}
+
+AudioOperationPtr AlsaEngine::setChainMute(AlsaChainedDevice* chain, bool state)
+{
+    bool hasSwitch = false;
+    for (snd_mixer_elem_t* elem : chain->elements()) {
+        if (!snd_mixer_selem_has_playback_switch(elem))
+            continue;
+
+        hasSwitch = true;
+        int error = snd_mixer_selem_set_playback_switch_all(elem, (int)!state);
+        if (error < 0)
+            return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+    }
+    if (!hasSwitch && state) {
+        chain->setVolumeNoCommit(0);
+        return commitChainVolume(chain);
+    }
+    return AudioOperation::finished();
+}
+
+void AlsaEngine::updateChain(AlsaChainedDevice* chain)
+{
+    const QList<snd_mixer_elem_t*>& elems = chain->elements();
+    snd_mixer_selem_channel_id_t channel = static_cast<snd_mixer_selem_channel_id_t>(0);
+    long min, max;
+    if (!chainRange(elems, &min, &max))
         return;
 
-    if (snd_mixer_selem_has_playback_switch(dev->element()))
-        snd_mixer_selem_set_playback_switch_all(dev->element(), (int)!state);
-    else if (state)
-        dev->setVolume(0);
+    long value = 0;
+    bool mute = false;
+    for (snd_mixer_elem_t* elem : elems) {
+        long elemValue;
+        snd_mixer_selem_get_playback_dB(elem, channel, &elemValue);
+        value += elemValue;
+
+        if (snd_mixer_selem_has_playback_switch(elem)) {
+            int on;
+            snd_mixer_selem_get_playback_switch(elem, channel, &on);
+            mute = mute || !on;
+        }
+    }
+    double minNorm = pow(10, (min - max) / 6000.0);
+    double volume = pow(10, (value - max) / 6000.0);
+    volume = (volume - minNorm) / (1 - minNorm) * 100.0;
+
+    chain->setVolumeNoCommit(qBound(0, static_cast<int>(lrint(volume)), 100));
+    chain->setMuteNoCommit(mute);
 }
 
 void AlsaEngine::updateDevice(AlsaDevice* device)
@@ -131,7 +453,17 @@ void AlsaEngine::updateDevice(AlsaDevice* device)
     if (!device)
         return;
 
-    // See https://github.com/alsa-project/alsa-utils/blob/master/alsamixer/volume_mapping.c#L83
+    // devices of deferred cards are read through their own controls
+    if (!device->element()) {
+        updateCtlDevice(device);
+        return;
+    }
+
+    if (AlsaChainedDevice* chain = qobject_cast<AlsaChainedDevice*>(device)) {
+        updateChain(chain);
+        return;
+    }
+
     snd_mixer_selem_channel_id_t channel = static_cast<snd_mixer_selem_channel_id_t>(0);
     snd_mixer_elem_t* elem = device->element();
     long min, max, value;
@@ -140,12 +472,7 @@ void AlsaEngine::updateDevice(AlsaDevice* device)
     if (m_isNormalized) {
         snd_mixer_selem_get_playback_dB(elem, channel, &value);
         snd_mixer_selem_get_playback_dB_range(elem, &min, &max);
-        volume = pow(10, (value - max) / 6000.0) * 100.0;
-
-        if (min != SND_CTL_TLV_DB_GAIN_MUTE) {
-            double minNorm = pow(10, (min - max) / 6000.0);
-            volume = (volume - minNorm) / (1 - minNorm);
-        }
+        volume = normalizedVolume(value, min, max);
         device->setVolumeNoCommit(volume);
     } else {
         min = device->volumeMin();
@@ -167,9 +494,527 @@ void AlsaEngine::updateDevice(AlsaDevice* device)
     }
 }
 
+// A chain write emits one event per element, the chain is read back once
+// after all of them were handled.
 void AlsaEngine::driveAlsaEventHandling(int fd)
 {
     snd_mixer_handle_events(m_mixerMap.value(fd));
+
+    const QSet<AlsaChainedDevice*> chains = m_dirtyChains;
+    m_dirtyChains.clear();
+    for (AlsaChainedDevice* chain : chains)
+        updateChain(chain);
+}
+
+void AlsaEngine::sampleHealth()
+{
+    QMap<int, AudioHealthSample> samples;
+    for (AudioDevice* dev : qAsConst(m_sinks)) {
+        int card = dev->index();
+        if (samples.contains(card))
+            continue;
+
+        AudioHealthSample sample;
+        QSet<QString> xruns;
+        if (!readPcmStatus(card, &sample, &xruns)) {
+            m_xrunStates.remove(card);
+            continue;
+        }
+        // An xrun only shows as the substream state: count the substreams
+        // entering it since the last poll. A lasting xrun counts once, the
+        // ones recovered between two polls are missed, a lower bound only.
+        const QSet<QString>& previous = m_xrunStates[card];
+        for (const QString& substream : qAsConst(xruns)) {
+            if (!previous.contains(substream))
+                ++m_xrunMap[card];
+        }
+        m_xrunStates.insert(card, xruns);
+
+        sample.timestamp = QDateTime::currentMSecsSinceEpoch();
+        sample.xruns = m_xrunMap.value(card);
+        samples.insert(card, sample);
+    }
+    for (AudioDevice* dev : qAsConst(m_sinks)) {
+        auto it = samples.constFind(dev->index());
+        if (it != samples.constEnd())
+            dev->recordHealth(*it);
+    }
+}
+
+AlsaChainedDevice* AlsaEngine::createChain(int cardNum, const QString& cardName, const QString& description,
+                                       const QStringList& path)
+{
+    AlsaChainedDevice* chain = new AlsaChainedDevice(this, this);
+    chain->setName(path.join(QLatin1Char('+')));
+    chain->setIndex(cardNum);
+    chain->setDescription(description + QStringLiteral(" - ") + chain->name());
+    chain->setCardName(cardName);
+    return chain;
+}
+
+// The chain stages are found again from its name, e.g. "Master+PCM+Speaker"
+bool AlsaEngine::bindChain(AlsaChainedDevice* chain, snd_mixer_t* mixer)
+{
+    QList<snd_mixer_elem_t*> elems;
+    const QStringList names = chain->name().split(QLatin1Char('+'));
+    for (const QString& name : names) {
+        snd_mixer_elem_t* elem = findChainStage(mixer, name.toLatin1().constData());
+        if (!elem)
+            return false;
+        elems.append(elem);
+    }
+    chain->setMixer(mixer);
+    chain->setElements(elems);
+    updateChain(chain);
+    chain->setBound(true);
+
+    m_chains.append(chain);
+    return true;
+}
+
+void AlsaEngine::appendChains(int cardNum, const QString& cardName, const QString& description,
+                              snd_mixer_t* mixer, QList<AudioDevice*>* chains)
+{
+    const QList<QStringList> paths = chainPaths([mixer](const char* name) { return findChainStage(mixer, name) != nullptr; });
+    for (const QStringList& path : paths) {
+        AlsaChainedDevice* chain = createChain(cardNum, cardName, description, path);
+        bindChain(chain, mixer);
+        chains->append(chain);
+    }
+}
+
+// The card's default PCM goes through dmix and plug where configured, the
+// click is made once in the format the PCM was set up with.
+void AlsaEngine::openFeedback(AudioDevice* device)
+{
+    if (m_feedbackPcm && device == m_feedbackDevice)
+        return;
+
+    closeFeedback();
+    if (!device)
+        return;
+
+    const QByteArray name = QStringLiteral("default:%1").arg(device->index()).toLatin1();
+    const unsigned rate = 48000;
+    const unsigned channels = 2;
+    int error = snd_pcm_open(&m_feedbackPcm, name.constData(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (error >= 0)
+        error = snd_pcm_set_params(m_feedbackPcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, channels, rate, 1,
+                                   (AudioFeedback::DurationMs + 20) * 1000);
+    if (error < 0) {
+        qWarning("Can't open feedback PCM %s: %s\n", name.constData(), snd_strerror(error));
+        closeFeedback();
+        return;
+    }
+    m_feedbackSample = AudioFeedback::click(AudioFeedback::Int16, rate, channels);
+    m_feedbackFrames = snd_pcm_bytes_to_frames(m_feedbackPcm, m_feedbackSample.size());
+    m_feedbackDevice = device;
+}
+
+void AlsaEngine::closeFeedback()
+{
+    m_feedbackDevice = nullptr;
+    if (m_feedbackPcm) {
+        snd_pcm_close(m_feedbackPcm);
+        m_feedbackPcm = nullptr;
+    }
+}
+
+// Dropping whatever is left restarts the click instead of queueing another,
+// the PCM stops by itself once the click played.
+void AlsaEngine::playFeedback(AudioDevice* device)
+{
+    if (!m_feedbackPcm || device != m_feedbackDevice)
+        return;
+
+    snd_pcm_drop(m_feedbackPcm);
+    snd_pcm_prepare(m_feedbackPcm);
+    snd_pcm_writei(m_feedbackPcm, m_feedbackSample.constData(), m_feedbackFrames);
+}
+
+// Mixer of a card, its poll descriptor driven by the dispatcher
+snd_mixer_t* AlsaEngine::openMixer(const char* hwName)
+{
+    // setup mixer and iterate over channels
+    snd_mixer_t* mixer = nullptr;
+    snd_mixer_open(&mixer, 0);
+    snd_mixer_attach(mixer, hwName);
+    snd_mixer_selem_register(mixer, nullptr, nullptr);
+    snd_mixer_load(mixer);
+
+    // setup event handler for mixer
+    snd_mixer_set_callback(mixer, alsa_mixer_event_callback);
+
+    // setup eventloop handling
+    struct pollfd pfd;
+    if (snd_mixer_poll_descriptors(mixer, &pfd, 1)) {
+        QSocketNotifier* notifier = new QSocketNotifier(pfd.fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, [this, notifier](QSocketDescriptor socket, QSocketNotifier::Type) {
+            // the notifier is level triggered, keep it quiet until the queued handler ran
+            notifier->setEnabled(false);
+            int fd = socket;
+            QPointer<QSocketNotifier> guard(notifier);
+            AudioDispatcher::instance()->post(AudioDispatcher::Backend, this, fd, [this, guard, fd]() {
+                if (!guard)
+                    return;
+                driveAlsaEventHandling(fd);
+                guard->setEnabled(true);
+            });
+        });
+        m_mixerMap.insert(pfd.fd, mixer);
+    }
+    return mixer;
+}
+
+void AlsaEngine::bindElement(AlsaDevice* dev, snd_mixer_t* mixer, snd_mixer_elem_t* elem)
+{
+    // set alsa specific members
+    dev->setMixer(mixer);
+    dev->setElement(elem);
+
+    // get & store the range
+    long min, max;
+    snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+    dev->setVolumeMinMax(min, max);
+
+    updateDevice(dev);
+    dev->setBound(true);
+
+    // register event callback
+    snd_mixer_elem_set_callback(elem, alsa_elem_event_callback);
+}
+
+// Cards with many controls, e.g. USB interfaces with matrix mixers, are only
+// listed through the ctl layer: a control id costs nothing, while loading the
+// mixer reads the info and value of every control and builds its simple
+// element. A device is read once used, through its own controls only, the
+// mixer is loaded for the chains alone.
+bool AlsaEngine::deferCard(int cardNum, snd_ctl_t* ctl, const QString& hwName, const QString& description,
+                           QList<AudioDevice*>* chains)
+{
+    snd_ctl_elem_list_t* list;
+    snd_ctl_elem_list_alloca(&list);
+    if (snd_ctl_elem_list(ctl, list) < 0 || snd_ctl_elem_list_get_count(list) < DeferredControls)
+        return false;
+
+    int error = snd_ctl_elem_list_alloc_space(list, snd_ctl_elem_list_get_count(list));
+    if (error >= 0)
+        error = snd_ctl_elem_list(ctl, list);
+    if (error < 0) {
+        qWarning("Can't list the controls of card %i: %s\n", cardNum, snd_strerror(error));
+        snd_ctl_elem_list_free_space(list);
+        return false;
+    }
+    m_deferredCards.insert(cardNum, { ctl, nullptr, hwName, description });
+
+    snd_ctl_elem_id_t* id;
+    snd_ctl_elem_id_alloca(&id);
+    for (unsigned int i = 0; i < snd_ctl_elem_list_get_used(list); ++i) {
+        snd_ctl_elem_list_get_id(list, i, id);
+        addDeferredDevice(cardNum, id);
+    }
+    snd_ctl_elem_list_free_space(list);
+    addDeferredChains(cardNum, chains);
+
+    // controls come and go with firmware or routing changes on such cards
+    struct pollfd pfd;
+    snd_ctl_nonblock(ctl, 1);
+    if (snd_ctl_subscribe_events(ctl, 1) >= 0 && snd_ctl_poll_descriptors(ctl, &pfd, 1)) {
+        QSocketNotifier* notifier = new QSocketNotifier(pfd.fd, QSocketNotifier::Read, this);
+        connect(notifier, &QSocketNotifier::activated, this, [this, notifier, cardNum]() {
+            notifier->setEnabled(false);
+            QPointer<QSocketNotifier> guard(notifier);
+            AudioDispatcher::instance()->post(AudioDispatcher::Backend, notifier, 0, [this, guard, cardNum]() {
+                if (!guard)
+                    return;
+                driveCtlEventHandling(cardNum);
+                guard->setEnabled(true);
+            });
+        });
+        m_deferredCards[cardNum].notifier = notifier;
+    }
+    return true;
+}
+
+// Same naming as the simple mixer: "Speaker Playback Volume" and the global
+// "Speaker Volume" are both "Speaker", capture volumes are no sinks
+static QString playbackVolumeName(const snd_ctl_elem_id_t* id)
+{
+    static const QLatin1String playback(" Playback Volume");
+    static const QLatin1String capture(" Capture Volume");
+    static const QLatin1String global(" Volume");
+    if (snd_ctl_elem_id_get_interface(id) != SND_CTL_ELEM_IFACE_MIXER)
+        return QString();
+
+    QString name = QString::fromLatin1(snd_ctl_elem_id_get_name(id));
+    if (name.endsWith(playback))
+        name.chop(playback.size());
+    else if (name.endsWith(global) && !name.endsWith(capture))
+        name.chop(global.size());
+    else
+        return QString();
+
+    return name;
+}
+
+// Listed unbound, volume and mute are read once the device gets used
+AlsaDevice* AlsaEngine::addDeferredDevice(int cardNum, const snd_ctl_elem_id_t* id)
+{
+    const QString name = playbackVolumeName(id);
+    const uint index = snd_ctl_elem_id_get_index(id);
+    const DeferredCard& card = m_deferredCards[cardNum];
+    if (name.isEmpty() || sinkByKey(AlsaDevice::makeKey(card.hwName, name, index)))
+        return nullptr;
+
+    AlsaDevice* dev = new AlsaDevice(Sink, this, this);
+    dev->setName(name);
+    dev->setIndex(cardNum);
+    dev->setElementIndex(index);
+    dev->setDescription(card.description + QStringLiteral(" - ") + dev->name());
+    dev->setCardName(card.hwName);
+    dev->setBound(false);
+    m_sinks.append(dev);
+    return dev;
+}
+
+// Listed like the chains of a loaded card, bound once the card mixer is loaded
+void AlsaEngine::addDeferredChains(int cardNum, QList<AudioDevice*>* chains)
+{
+    const DeferredCard& card = m_deferredCards[cardNum];
+    snd_ctl_t* ctl = card.ctl;
+    const QList<QStringList> paths = chainPaths([ctl](const char* name) { return hasDbVolume(ctl, name); });
+    for (const QStringList& path : paths) {
+        AlsaChainedDevice* chain = createChain(cardNum, card.hwName, card.description, path);
+        chain->setBound(false);
+        chains->append(chain);
+    }
+}
+
+// Only the controls of the device are read, e.g. "Speaker Playback Volume"
+// and "Speaker Playback Switch", the card mixer stays unloaded
+bool AlsaEngine::bindCtlElement(AlsaDevice* dev)
+{
+    auto card = m_deferredCards.find(dev->index());
+    if (card == m_deferredCards.end())
+        return false;
+
+    snd_ctl_elem_info_t* info;
+    snd_ctl_elem_info_alloca(&info);
+    CtlElement element;
+    for (const char* suffix : { " Playback Volume", " Volume" }) {
+        if (findControl(card->ctl, dev->name() + QLatin1String(suffix), dev->elementIndex(),
+                        SND_CTL_ELEM_TYPE_INTEGER, info)) {
+            element.volume = snd_ctl_elem_info_get_numid(info);
+            element.volumeChannels = snd_ctl_elem_info_get_count(info);
+            element.min = snd_ctl_elem_info_get_min(info);
+            element.max = snd_ctl_elem_info_get_max(info);
+            element.tlv = readTlv(card->ctl, info);
+            break;
+        }
+    }
+    if (!element.volume || element.min >= element.max)
+        return false;
+
+    for (const char* suffix : { " Playback Switch", " Switch" }) {
+        if (findControl(card->ctl, dev->name() + QLatin1String(suffix), dev->elementIndex(),
+                        SND_CTL_ELEM_TYPE_BOOLEAN, info)) {
+            element.mute = snd_ctl_elem_info_get_numid(info);
+            element.muteChannels = snd_ctl_elem_info_get_count(info);
+            break;
+        }
+    }
+    card->elements.insert(dev->key(), element);
+    dev->setVolumeMinMax(element.min, element.max);
+    updateCtlDevice(dev);
+    dev->setBound(true);
+    return true;
+}
+
+void AlsaEngine::updateCtlDevice(AlsaDevice* device)
+{
+    auto card = m_deferredCards.find(device->index());
+    if (card == m_deferredCards.end())
+        return;
+
+    auto element = card->elements.find(device->key());
+    if (element == card->elements.end())
+        return;
+
+    snd_ctl_elem_value_t* value;
+    snd_ctl_elem_value_alloca(&value);
+    snd_ctl_elem_value_set_numid(value, element->volume);
+    if (snd_ctl_elem_read(card->ctl, value) < 0)
+        return;
+
+    const long raw = snd_ctl_elem_value_get_integer(value, 0);
+    unsigned int* db = m_isNormalized ? dbInfo(element->tlv) : nullptr;
+    long dB, min, max;
+    if (db && snd_tlv_convert_to_dB(db, element->min, element->max, raw, &dB) >= 0
+        && snd_tlv_get_dB_range(db, element->min, element->max, &min, &max) >= 0)
+        device->setVolumeNoCommit(lrint(normalizedVolume(dB, min, max)));
+    else
+        device->setVolumeNoCommit(lrint(static_cast<double>(raw - element->min) * 100.0 / (element->max - element->min)));
+
+    if (element->mute) {
+        snd_ctl_elem_value_clear(value);
+        snd_ctl_elem_value_set_numid(value, element->mute);
+        if (snd_ctl_elem_read(card->ctl, value) >= 0)
+            device->setMuteNoCommit(!snd_ctl_elem_value_get_boolean(value, 0));
+    }
+}
+
+AudioOperationPtr AlsaEngine::commitCtlVolume(AlsaDevice* dev)
+{
+    auto card = m_deferredCards.find(dev->index());
+    if (card == m_deferredCards.end() || !card->elements.contains(dev->key()))
+        return AudioOperation::failed(QStringLiteral("Invalid ALSA device"));
+
+    CtlElement& element = card->elements[dev->key()];
+    const double volume = static_cast<double>(dev->volume()) / 100.0;
+    unsigned int* db = m_isNormalized ? dbInfo(element.tlv) : nullptr;
+    long raw, min, max;
+    if (!db || snd_tlv_get_dB_range(db, element.min, element.max, &min, &max) < 0
+        || snd_tlv_convert_from_dB(db, element.min, element.max, normalizedDb(volume, min, max), &raw, 0) < 0)
+        raw = lrint(volume * (element.max - element.min)) + element.min;
+
+    snd_ctl_elem_value_t* value;
+    snd_ctl_elem_value_alloca(&value);
+    snd_ctl_elem_value_set_numid(value, element.volume);
+    for (unsigned int i = 0; i < element.volumeChannels; ++i)
+        snd_ctl_elem_value_set_integer(value, i, raw);
+
+    int error = snd_ctl_elem_write(card->ctl, value);
+    if (error < 0)
+        return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+
+    return AudioOperation::finished();
+}
+
+AudioOperationPtr AlsaEngine::setCtlMute(AlsaDevice* dev, bool state)
+{
+    auto card = m_deferredCards.find(dev->index());
+    if (card == m_deferredCards.end() || !card->elements.contains(dev->key()))
+        return AudioOperation::failed(QStringLiteral("Invalid ALSA device"));
+
+    const CtlElement& element = card->elements[dev->key()];
+    if (!element.mute) {
+        if (!state)
+            return AudioOperation::finished();
+
+        dev->setVolumeNoCommit(0);
+        return commitCtlVolume(dev);
+    }
+    snd_ctl_elem_value_t* value;
+    snd_ctl_elem_value_alloca(&value);
+    snd_ctl_elem_value_set_numid(value, element.mute);
+    for (unsigned int i = 0; i < element.muteChannels; ++i)
+        snd_ctl_elem_value_set_boolean(value, i, !state);
+
+    int error = snd_ctl_elem_write(card->ctl, value);
+    if (error < 0)
+        return AudioOperation::failed(QString::fromLatin1(snd_strerror(error)));
+
+    return AudioOperation::finished();
+}
+
+void AlsaEngine::driveCtlEventHandling(int cardNum)
+{
+    const DeferredCard card = m_deferredCards.value(cardNum);
+    snd_ctl_event_t* event;
+    snd_ctl_event_alloca(&event);
+    snd_ctl_elem_id_t* id;
+    snd_ctl_elem_id_alloca(&id);
+    bool listChanged = false;
+
+    while (snd_ctl_read(card.ctl, event) > 0) {
+        if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+            continue;
+
+        const unsigned int mask = snd_ctl_event_elem_get_mask(event);
+        snd_ctl_event_elem_get_id(event, id);
+        if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+            const QString name = playbackVolumeName(id);
+            const QString key = AlsaDevice::makeKey(card.hwName, name, snd_ctl_elem_id_get_index(id));
+            AudioDevice* dev = name.isEmpty() ? nullptr : sinkByKey(key);
+            if (dev) {
+                m_sinks.removeAll(dev);
+                m_deferredCards[cardNum].elements.remove(key);
+                delete dev;
+                listChanged = true;
+            }
+            continue;
+        }
+        if (mask & SND_CTL_EVENT_MASK_ADD)
+            listChanged = addDeferredDevice(cardNum, id) || listChanged;
+
+        // values of the used devices only, the others are read once used
+        if (mask & SND_CTL_EVENT_MASK_VALUE) {
+            const unsigned int numid = snd_ctl_event_elem_get_numid(event);
+            for (auto it = card.elements.cbegin(); it != card.elements.cend(); ++it) {
+                if (it->volume == numid || it->mute == numid) {
+                    updateDevice(qobject_cast<AlsaDevice*>(sinkByKey(it.key())));
+                    break;
+                }
+            }
+        }
+    }
+    if (listChanged)
+        emit sinkListChanged();
+}
+
+// Chains need the card simple mixer, plain devices their own controls only
+void AlsaEngine::useDevice(AudioDevice* device)
+{
+    AlsaDevice* dev = qobject_cast<AlsaDevice*>(device);
+    if (!dev || dev->isBound() || !m_deferredCards.contains(dev->index()))
+        return;
+
+    if (qobject_cast<AlsaChainedDevice*>(dev) || !bindCtlElement(dev))
+        loadDeferredCard(dev->index());
+}
+
+// Every device of the card moves over to its simple element
+void AlsaEngine::loadDeferredCard(int cardNum)
+{
+    const DeferredCard card = m_deferredCards.take(cardNum);
+    delete card.notifier;
+    snd_ctl_close(card.ctl);
+
+    snd_mixer_t* mixer = openMixer(card.hwName.toLatin1().constData());
+    snd_mixer_selem_id_t* sid;
+    snd_mixer_selem_id_alloca(&sid);
+    bool listChanged = false;
+    const QList<AudioDevice*> sinks = m_sinks;
+    for (AudioDevice* sink : sinks) {
+        AlsaDevice* alsaDev = qobject_cast<AlsaDevice*>(sink);
+        if (!alsaDev || alsaDev->index() != static_cast<uint>(cardNum) || alsaDev->element())
+            continue;
+
+        if (AlsaChainedDevice* chain = qobject_cast<AlsaChainedDevice*>(alsaDev)) {
+            if (!bindChain(chain, mixer)) {
+                m_sinks.removeAll(chain);
+                delete chain;
+                listChanged = true;
+            }
+            continue;
+        }
+        snd_mixer_selem_id_set_name(sid, alsaDev->name().toLatin1().constData());
+        snd_mixer_selem_id_set_index(sid, alsaDev->elementIndex());
+        snd_mixer_elem_t* elem = snd_mixer_find_selem(mixer, sid);
+        if (elem && snd_mixer_selem_has_playback_volume(elem)) {
+            bindElement(alsaDev, mixer, elem);
+        } else {
+            // listed from a control the simple mixer does not expose as a
+            // playback volume, it could not be driven any longer
+            m_sinks.removeAll(alsaDev);
+            delete alsaDev;
+            listChanged = true;
+        }
+    }
+    snd_config_update_free_global();
+
+    if (listChanged)
+        emit sinkListChanged();
 }
 
 void AlsaEngine::discoverDevices()
@@ -177,6 +1022,8 @@ void AlsaEngine::discoverDevices()
     int error;
     int cardNum = -1;
     const int BUFF_SIZE = 64;
+    // appended after every single element, so the device indexes stay the same
+    QList<AudioDevice*> chains;
 
     while (true) {
         if ((error = snd_card_next(&cardNum)) < 0) {
@@ -209,25 +1056,11 @@ void AlsaEngine::discoverDevices()
 
         if ((error = snd_ctl_card_info(cardHandle, cardInfo)) < 0) {
             qWarning("Can't get info for card %i: %s\n", cardNum, snd_strerror(error));
+        } else if (deferCard(cardNum, cardHandle, QString::fromLatin1(str), cardName, &chains)) {
+            // the handle stays open to watch the card controls
+            continue;
         } else {
-            // setup mixer and iterate over channels
-            snd_mixer_t* mixer = nullptr;
-            snd_mixer_open(&mixer, 0);
-            snd_mixer_attach(mixer, str);
-            snd_mixer_selem_register(mixer, nullptr, nullptr);
-            snd_mixer_load(mixer);
-
-            // setup event handler for mixer
-            snd_mixer_set_callback(mixer, alsa_mixer_event_callback);
-
-            // setup eventloop handling
-            struct pollfd pfd;
-            if (snd_mixer_poll_descriptors(mixer, &pfd, 1)) {
-                QSocketNotifier* notifier = new QSocketNotifier(pfd.fd, QSocketNotifier::Read, this);
-                connect(notifier, &QSocketNotifier::activated, this, [this](QSocketDescriptor socket, QSocketNotifier::Type) { this->driveAlsaEventHandling(socket); });
-                m_mixerMap.insert(pfd.fd, mixer);
-            }
-
+            snd_mixer_t* mixer = openMixer(str);
             snd_mixer_elem_t* mixerElem = nullptr;
             mixerElem = snd_mixer_first_elem(mixer);
 
@@ -238,31 +1071,20 @@ void AlsaEngine::discoverDevices()
                     dev->setName(QString::fromLatin1(snd_mixer_selem_get_name(mixerElem)));
                     dev->setIndex(cardNum);
                     dev->setDescription(cardName + QStringLiteral(" - ") + dev->name());
-
-                    // set alsa specific members
                     dev->setCardName(QString::fromLatin1(str));
-                    dev->setMixer(mixer);
-                    dev->setElement(mixerElem);
-
-                    // get & store the range
-                    long min, max;
-                    snd_mixer_selem_get_playback_volume_range(mixerElem, &min, &max);
-                    dev->setVolumeMinMax(min, max);
-
-                    updateDevice(dev);
-
-                    // register event callback
-                    snd_mixer_elem_set_callback(mixerElem, alsa_elem_event_callback);
+                    bindElement(dev, mixer, mixerElem);
 
                     m_sinks.append(dev);
                 }
 
                 mixerElem = snd_mixer_elem_next(mixerElem);
             }
+            appendChains(cardNum, QString::fromLatin1(str), cardName, mixer, &chains);
         }
 
         snd_ctl_close(cardHandle);
     }
+    m_sinks.append(chains);
 
     snd_config_update_free_global();
 }
@@ -29,13 +29,19 @@
 
 #include "audio/engine.hpp"
 
+#include <QByteArray>
 #include <QObject>
 #include <QList>
 #include <QMap>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
 #include <QTimer>
+#include <QVector>
 
 #include <alsa/asoundlib.h>
 
+class AlsaChainedDevice;
 class AlsaDevice;
 class QSocketNotifier;
 
@@ -44,14 +50,26 @@ class AlsaEngine : public AudioEngine {
 
 public:
     AlsaEngine(QObject* parent = nullptr);
+    ~AlsaEngine();
     static AlsaEngine* instance();
 
     int id() const { return EngineId::Alsa; }
 
     int volumeMax(AudioDevice* device) const;
     AlsaDevice* getDeviceByAlsaElem(snd_mixer_elem_t* elem) const;
+    // Chains containing elem are refreshed once the pending events are drained
+    void invalidateChains(snd_mixer_elem_t* elem);
 
     void setNormalized(bool);
+    // Reads a device of a deferred card, see deferCard()
+    void useDevice(AudioDevice* device) override;
+
+    AudioOperationPtr commitDeviceVolumeAsync(AudioDevice* device) override;
+    AudioOperationPtr setMuteAsync(AudioDevice* device, bool state) override;
+
+    void openFeedback(AudioDevice* device) override;
+    void closeFeedback() override;
+    void playFeedback(AudioDevice* device) override;
 
 public slots:
     void commitDeviceVolume(AudioDevice* device);
@@ -60,9 +78,60 @@ public slots:
 
 private slots:
     void driveAlsaEventHandling(int fd);
+    void sampleHealth();
 
 private:
+    // Control count from which a card mixer is only loaded on use
+    static constexpr unsigned int DeferredControls = 128;
+    // Volume control of a used device of a deferred card and its switch
+    struct CtlElement {
+        unsigned int volume = 0; // numid
+        unsigned int volumeChannels = 0;
+        unsigned int mute = 0; // numid, 0 without switch
+        unsigned int muteChannels = 0;
+        long min = 0;
+        long max = 0;
+        QVector<unsigned int> tlv; // dB info, empty without
+    };
+    struct DeferredCard {
+        snd_ctl_t* ctl = nullptr;
+        QSocketNotifier* notifier = nullptr;
+        QString hwName;
+        QString description;
+        QMap<QString, CtlElement> elements; // device key
+    };
+
     void discoverDevices();
+    snd_mixer_t* openMixer(const char* hwName);
+    void bindElement(AlsaDevice* dev, snd_mixer_t* mixer, snd_mixer_elem_t* elem);
+    bool deferCard(int cardNum, snd_ctl_t* ctl, const QString& hwName, const QString& description,
+                   QList<AudioDevice*>* chains);
+    AlsaDevice* addDeferredDevice(int cardNum, const snd_ctl_elem_id_t* id);
+    void addDeferredChains(int cardNum, QList<AudioDevice*>* chains);
+    void driveCtlEventHandling(int cardNum);
+    bool bindCtlElement(AlsaDevice* dev);
+    void updateCtlDevice(AlsaDevice* device);
+    AudioOperationPtr commitCtlVolume(AlsaDevice* dev);
+    AudioOperationPtr setCtlMute(AlsaDevice* dev, bool state);
+    void loadDeferredCard(int cardNum);
+    AlsaChainedDevice* createChain(int cardNum, const QString& cardName, const QString& description,
+                                   const QStringList& path);
+    bool bindChain(AlsaChainedDevice* chain, snd_mixer_t* mixer);
+    void appendChains(int cardNum, const QString& cardName, const QString& description, snd_mixer_t* mixer,
+                      QList<AudioDevice*>* chains);
+    AudioOperationPtr commitChainVolume(AlsaChainedDevice* chain);
+    AudioOperationPtr setChainMute(AlsaChainedDevice* chain, bool state);
+    void updateChain(AlsaChainedDevice* chain);
     QMap<int, snd_mixer_t*> m_mixerMap;
+    QMap<int, quint32> m_xrunMap; // card number, xruns seen
+    QMap<int, QSet<QString>> m_xrunStates; // card number, substreams in XRUN at the last poll
+    QMap<int, DeferredCard> m_deferredCards; // card number
+    QList<AlsaChainedDevice*> m_chains;
+    QSet<AlsaChainedDevice*> m_dirtyChains;
+    snd_pcm_t* m_feedbackPcm;
+    QPointer<AudioDevice> m_feedbackDevice;
+    QByteArray m_feedbackSample;
+    snd_pcm_uframes_t m_feedbackFrames;
+    QTimer m_healthTimer;
     static AlsaEngine* m_instance;
 };
@@ -27,20 +27,23 @@
 
 #include "audio/engine/pulseaudio.hpp"
 #include "audio/device.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/feedback.hpp"
 
+#include <QDateTime>
 #include <QMetaType>
+#include <QPointer>
+#include <QSet>
 #include <QtDebug>
 
+#include <cmath>
+#include <cstring>
+
 //#define PULSEAUDIO_ENGINE_DEBUG
 
 static void sinkInfoCallback(pa_context* context, const pa_sink_info* info, int isLast, void* userdata)
 {
     PulseAudioEngine* pulseEngine = static_cast<PulseAudioEngine*>(userdata);
-    QMap<pa_sink_state, QString> stateMap;
-    stateMap[PA_SINK_INVALID_STATE] = QLatin1String("n/a");
-    stateMap[PA_SINK_RUNNING] = QLatin1String("RUNNING");
-    stateMap[PA_SINK_IDLE] = QLatin1String("IDLE");
-    stateMap[PA_SINK_SUSPENDED] = QLatin1String("SUSPENDED");
 
     if (isLast < 0) {
         pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
@@ -56,6 +59,91 @@ static void sinkInfoCallback(pa_context* context, const pa_sink_info* info, int
     pulseEngine->addOrUpdateSink(info);
 }
 
+static void cardInfoCallback(pa_context* context, const pa_card_info* info, int isLast, void* userdata)
+{
+    PulseAudioEngine* pulseEngine = static_cast<PulseAudioEngine*>(userdata);
+
+    if (isLast < 0) {
+        pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
+        qWarning() << QStringLiteral("Failed to get card information: %1").arg(QString::fromUtf8(pa_strerror(pa_context_errno(context))));
+        return;
+    }
+
+    if (isLast) {
+        pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
+        return;
+    }
+
+    pulseEngine->addOrUpdateCard(info);
+}
+
+static void sourceOutputInfoCallback(pa_context* context, const pa_source_output_info* info, int isLast, void* userdata)
+{
+    PulseAudioEngine* pulseEngine = static_cast<PulseAudioEngine*>(userdata);
+
+    if (isLast < 0) {
+        // the stream may be gone already, its removal event follows
+        pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
+        return;
+    }
+
+    if (isLast) {
+        pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
+        return;
+    }
+
+    pulseEngine->addOrUpdateSourceOutput(info);
+}
+
+static void sinkInputInfoCallback(pa_context* context, const pa_sink_input_info* info, int isLast, void* userdata)
+{
+    PulseAudioEngine* pulseEngine = static_cast<PulseAudioEngine*>(userdata);
+
+    if (isLast) {
+        pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
+        return;
+    }
+
+    pulseEngine->addOrUpdateSinkInput(info);
+}
+
+// Keeps the loudest peak until the GUI collects it, no allocation and no wakeup
+static void meterReadCallback(pa_stream* stream, size_t /*nbytes*/, void* userdata)
+{
+    std::atomic<float>* level = static_cast<std::atomic<float>*>(userdata);
+    float peak = 0.0f;
+
+    while (pa_stream_readable_size(stream) > 0) {
+        const void* data;
+        size_t bytes;
+        if (pa_stream_peek(stream, &data, &bytes) < 0 || bytes == 0)
+            break;
+
+        // data is null on holes
+        const float* samples = static_cast<const float*>(data);
+        for (size_t i = 0; samples && i < bytes / sizeof(float); ++i)
+            peak = qMax(peak, std::fabs(samples[i]));
+
+        pa_stream_drop(stream);
+    }
+    float current = level->load(std::memory_order_relaxed);
+    while (peak > current && !level->compare_exchange_weak(current, peak, std::memory_order_relaxed)) { }
+}
+
+static AudioDevice::State deviceState(pa_sink_state_t state)
+{
+    switch (state) {
+    case PA_SINK_RUNNING:
+        return AudioDevice::Running;
+    case PA_SINK_IDLE:
+        return AudioDevice::Idle;
+    case PA_SINK_SUSPENDED:
+        return AudioDevice::Suspended;
+    default:
+        return AudioDevice::Unknown;
+    }
+}
+
 static void contextEventCallback(pa_context* /*context*/, const char*
 #ifdef PULSEAUDIO_ENGINE_DEBUG
                                                               name
@@ -117,13 +205,78 @@ static void contextSuccessCallback(pa_context* context, int success, void* userd
     pa_threaded_mainloop_signal(pulseEngine->mainloop(), 0);
 }
 
+// Ties a pa_operation to the AudioOperation handed out to the caller
+struct PulseAudioOperation {
+    PulseAudioEngine* engine;
+    AudioOperationPtr result;
+};
+
+static void operationSuccessCallback(pa_context* context, int success, void* userdata)
+{
+    PulseAudioOperation* pending = static_cast<PulseAudioOperation*>(userdata);
+    AudioOperationPtr result = pending->result;
+    QString error;
+    if (!success)
+        error = QString::fromUtf8(pa_strerror(pa_context_errno(context)));
+
+    // we are in the mainloop thread, complete the operation in the engine one
+    QMetaObject::invokeMethod(pending->engine, [result, error]() {
+        if (error.isEmpty())
+            result->finish();
+        else
+            result->fail(error);
+    }, Qt::QueuedConnection);
+}
+
+static void operationStateCallback(pa_operation* operation, void* userdata)
+{
+    pa_operation_state_t state = pa_operation_get_state(operation);
+    if (state == PA_OPERATION_RUNNING)
+        return;
+
+    PulseAudioOperation* pending = static_cast<PulseAudioOperation*>(userdata);
+    if (state == PA_OPERATION_CANCELLED) {
+        // e.g. the context went away before replying
+        AudioOperationPtr result = pending->result;
+        QMetaObject::invokeMethod(pending->engine, [result]() { result->cancel(); }, Qt::QueuedConnection);
+    }
+    pa_operation_unref(operation);
+    delete pending;
+}
+
 static void contextSubscriptionCallback(pa_context* /*context*/, pa_subscription_event_type_t t, uint32_t idx, void* userdata)
 {
     PulseAudioEngine* pulseEngine = reinterpret_cast<PulseAudioEngine*>(userdata);
-    if (PA_SUBSCRIPTION_EVENT_REMOVE == t)
-        pulseEngine->removeSink(idx);
-    else
-        pulseEngine->requestSinkInfoUpdate(idx);
+    bool removed = (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE;
+
+    switch (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SINK:
+        if (removed)
+            pulseEngine->requestSinkRemoval(idx);
+        else
+            pulseEngine->requestSinkInfoUpdate(idx);
+        break;
+    case PA_SUBSCRIPTION_EVENT_CARD:
+        if (removed)
+            pulseEngine->requestCardRemoval(idx);
+        else
+            pulseEngine->requestCardInfoUpdate(idx);
+        break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT:
+        if (removed)
+            pulseEngine->requestSourceOutputRemoval(idx);
+        else
+            pulseEngine->requestSourceOutputUpdate(idx);
+        break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+        if (removed)
+            pulseEngine->requestSinkInputRemoval(idx);
+        else
+            pulseEngine->requestSinkInputUpdate(idx);
+        break;
+    default:
+        break;
+    }
 }
 
 PulseAudioEngine::PulseAudioEngine(QObject* parent)
@@ -132,6 +285,9 @@ PulseAudioEngine::PulseAudioEngine(QObject* parent)
     , m_contextState(PA_CONTEXT_UNCONNECTED)
     , m_ready(false)
     , m_maximumVolume(PA_VOLUME_UI_MAX)
+    , m_clientIndex(PA_INVALID_INDEX)
+    , m_feedbackStream(nullptr)
+    , m_meterUsers(0)
 {
     qRegisterMetaType<pa_context_state_t>("pa_context_state_t");
 
@@ -155,12 +311,40 @@ PulseAudioEngine::PulseAudioEngine(QObject* parent)
     m_mainLoopApi = pa_threaded_mainloop_get_api(m_mainLoop);
 
     connect(this, &PulseAudioEngine::contextStateChanged, this, &PulseAudioEngine::handleContextStateChanged);
+    // subscription events arrive from the mainloop thread
+    connect(this, &PulseAudioEngine::sinkInfoChanged, this, &PulseAudioEngine::queueSinkInfo, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::sinkRemoved, this, &PulseAudioEngine::queueSinkRemoval, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::cardInfoChanged, this, &PulseAudioEngine::queueCardInfo, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::cardRemoved, this, &PulseAudioEngine::queueCardRemoval, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::sourceOutputChanged, this, &PulseAudioEngine::queueSourceOutputInfo, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::sourceOutputRemoved, this, &PulseAudioEngine::queueSourceOutputRemoval, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::sinkInputChanged, this, &PulseAudioEngine::queueSinkInputInfo, Qt::QueuedConnection);
+    connect(this, &PulseAudioEngine::sinkInputRemoved, this, &PulseAudioEngine::queueSinkInputRemoval, Qt::QueuedConnection);
+
+    // one wakeup for all the meters, whatever the number of streams
+    m_meterTimer.setInterval(100);
+    connect(&m_meterTimer, &QTimer::timeout, this, &PulseAudioEngine::collectStreamLevels);
+
+    // corks the feedback stream once the click played, so the sink can go idle again
+    m_feedbackTimer.setSingleShot(true);
+    m_feedbackTimer.setInterval(AudioFeedback::DurationMs + 100);
+    connect(&m_feedbackTimer, &QTimer::timeout, this, [this]() {
+        if (!m_feedbackStream)
+            return;
+        pa_threaded_mainloop_lock(m_mainLoop);
+        if (pa_operation* operation = pa_stream_cork(m_feedbackStream, 1, nullptr, nullptr))
+            pa_operation_unref(operation);
+        pa_threaded_mainloop_unlock(m_mainLoop);
+    });
 
     connectContext();
 }
 
 PulseAudioEngine::~PulseAudioEngine()
 {
+    closeFeedback();
+    closeStreamMeters();
+
     if (m_context) {
         pa_context_unref(m_context);
         m_context = nullptr;
@@ -179,7 +363,13 @@ void PulseAudioEngine::removeSink(uint32_t idx)
         return;
 
     QScopedPointer<AudioDevice> dev { *dev_i };
+    if (dev.data() == m_feedbackDevice)
+        closeFeedback();
+
     m_cVolumeMap.remove(dev.data());
+    m_specMap.remove(dev.data());
+    m_monitorMap.remove(idx);
+    m_portsMap.remove(dev.data());
     m_sinks.erase(dev_i);
     emit sinkListChanged();
 }
@@ -206,9 +396,30 @@ void PulseAudioEngine::addOrUpdateSink(const pa_sink_info* info)
     dev->setIndex(info->index);
     dev->setDescription(QString::fromUtf8(info->description));
     dev->setMuteNoCommit(info->mute);
+    dev->setState(deviceState(info->state));
+
+    // sampled on sink events only, PA has no underrun counter for sinks
+    AudioHealthSample sample;
+    sample.timestamp = QDateTime::currentMSecsSinceEpoch();
+    sample.latency = info->latency;
+    sample.configuredLatency = info->configured_latency;
+    dev->recordHealth(sample);
 
     // TODO: save separately? alsa does not have it
     m_cVolumeMap.insert(dev, info->volume);
+    m_specMap.insert(dev, info->sample_spec);
+    m_monitorMap.insert(info->index, info->monitor_source);
+
+    PulseAudioSinkPorts ports;
+    ports.card = info->card;
+    if (info->active_port)
+        ports.activePort = QString::fromUtf8(info->active_port->name);
+    for (uint32_t i = 0; i < info->n_ports; ++i) {
+        const pa_sink_port_info* port = info->ports[i];
+        ports.ports.append(PulseAudioChoice { QString::fromUtf8(port->name), QString::fromUtf8(port->description),
+                                               port->available != PA_PORT_AVAILABLE_NO });
+    }
+    m_portsMap.insert(dev, ports);
 
     pa_volume_t v = pa_cvolume_avg(&(info->volume));
     // convert real volume to percentage
@@ -230,24 +441,312 @@ void PulseAudioEngine::requestSinkInfoUpdate(uint32_t idx)
     emit sinkInfoChanged(idx);
 }
 
+void PulseAudioEngine::requestSinkRemoval(uint32_t idx)
+{
+    emit sinkRemoved(idx);
+}
+
+// Backend work is coalesced per sink, a burst of events costs one round-trip
+void PulseAudioEngine::queueSinkInfo(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, this, idx, [self, idx]() {
+        if (self)
+            self->retrieveSinkInfo(idx);
+    });
+}
+
+void PulseAudioEngine::queueSinkRemoval(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, this, idx, [self, idx]() {
+        if (self)
+            self->removeSink(idx);
+    });
+}
+
+void PulseAudioEngine::removeCard(uint32_t idx)
+{
+    m_cards.remove(idx);
+}
+
+void PulseAudioEngine::addOrUpdateCard(const pa_card_info* info)
+{
+    PulseAudioCard card;
+    card.index = info->index;
+    card.name = QString::fromUtf8(info->name);
+    card.description = QString::fromUtf8(pa_proplist_gets(info->proplist, PA_PROP_DEVICE_DESCRIPTION));
+    if (card.description.isEmpty())
+        card.description = card.name;
+    if (info->active_profile2)
+        card.activeProfile = QString::fromUtf8(info->active_profile2->name);
+
+    for (uint32_t i = 0; i < info->n_profiles; ++i) {
+        const pa_card_profile_info2* profile = info->profiles2[i];
+        card.profiles.append(PulseAudioChoice { QString::fromUtf8(profile->name), QString::fromUtf8(profile->description),
+                                                 profile->available != 0 });
+    }
+    m_cards.insert(card.index, card);
+}
+
+void PulseAudioEngine::requestCardInfoUpdate(uint32_t idx)
+{
+    emit cardInfoChanged(idx);
+}
+
+void PulseAudioEngine::requestCardRemoval(uint32_t idx)
+{
+    emit cardRemoved(idx);
+}
+
+// Same coalescing as sinks, under a different owner so indexes don't clash
+void PulseAudioEngine::queueCardInfo(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_cards, idx, [self, idx]() {
+        if (self)
+            self->retrieveCardInfo(idx);
+    });
+}
+
+void PulseAudioEngine::queueCardRemoval(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_cards, idx, [self, idx]() {
+        if (self)
+            self->removeCard(idx);
+    });
+}
+
+// Recording streams are counted per source as they come and go,
+// a new stream costs one info request, a removed one none.
+void PulseAudioEngine::removeSourceOutput(uint32_t idx)
+{
+    auto it = m_sourceOutputs.find(idx);
+    if (it == m_sourceOutputs.end())
+        return;
+
+    if (--m_recordingMap[*it] <= 0)
+        m_recordingMap.remove(*it);
+
+    m_sourceOutputs.erase(it);
+    emit recordingStreamsChanged(m_sourceOutputs.count());
+}
+
+// Forgets every stream, the server sends them all again once reconnected
+void PulseAudioEngine::clearSourceOutputs()
+{
+    if (m_sourceOutputs.isEmpty())
+        return;
+
+    m_sourceOutputs.clear();
+    m_recordingMap.clear();
+    emit recordingStreamsChanged(0);
+}
+
+// Peak detection (e.g. a mixer's level meter) and sink monitors are not recordings
+bool PulseAudioEngine::isRecording(const pa_source_output_info* info) const
+{
+    // our own streams (e.g. level meters) are not recordings either
+    if (info->client != PA_INVALID_INDEX && info->client == m_clientIndex)
+        return false;
+
+    // PA_STREAM_PEAK_DETECT streams get the "peaks" resampler
+    if (info->resample_method && qstrcmp(info->resample_method, "peaks") == 0)
+        return false;
+
+    return !std::any_of(m_monitorMap.cbegin(), m_monitorMap.cend(), [info](uint32_t source) { return source == info->source; });
+}
+
+void PulseAudioEngine::addOrUpdateSourceOutput(const pa_source_output_info* info)
+{
+    if (!isRecording(info)) {
+        // e.g. moved onto a monitor
+        removeSourceOutput(info->index);
+        return;
+    }
+
+    auto it = m_sourceOutputs.find(info->index);
+    if (it != m_sourceOutputs.end()) {
+        if (*it == info->source)
+            return;
+
+        // moved to another source
+        if (--m_recordingMap[*it] <= 0)
+            m_recordingMap.remove(*it);
+
+        *it = info->source;
+        ++m_recordingMap[info->source];
+        emit recordingStreamsChanged(m_sourceOutputs.count());
+        return;
+    }
+    m_sourceOutputs.insert(info->index, info->source);
+    ++m_recordingMap[info->source];
+    emit recordingStreamsChanged(m_sourceOutputs.count());
+}
+
+void PulseAudioEngine::requestSourceOutputUpdate(uint32_t idx)
+{
+    emit sourceOutputChanged(idx);
+}
+
+void PulseAudioEngine::requestSourceOutputRemoval(uint32_t idx)
+{
+    emit sourceOutputRemoved(idx);
+}
+
+void PulseAudioEngine::queueSourceOutputInfo(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_sourceOutputs, idx, [self, idx]() {
+        if (self)
+            self->retrieveSourceOutputInfo(idx);
+    });
+}
+
+void PulseAudioEngine::queueSourceOutputRemoval(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_sourceOutputs, idx, [self, idx]() {
+        if (self)
+            self->removeSourceOutput(idx);
+    });
+}
+
+const PulseAudioCard* PulseAudioEngine::cardOf(AudioDevice* sink) const
+{
+    auto ports = m_portsMap.constFind(sink);
+    if (ports == m_portsMap.constEnd())
+        return nullptr;
+
+    auto card = m_cards.constFind(ports->card);
+    return card == m_cards.constEnd() ? nullptr : &(*card);
+}
+
+const PulseAudioSinkPorts* PulseAudioEngine::portsOf(AudioDevice* sink) const
+{
+    auto ports = m_portsMap.constFind(sink);
+    return ports == m_portsMap.constEnd() ? nullptr : &(*ports);
+}
+
+AudioDevice* PulseAudioEngine::sinkOfCard(uint32_t card) const
+{
+    for (AudioDevice* dev : m_sinks) {
+        auto ports = m_portsMap.constFind(dev);
+        if (ports != m_portsMap.constEnd() && ports->card == card)
+            return dev;
+    }
+    return nullptr;
+}
+
+// The card switch is a single request, the sinks it creates or removes then
+// arrive through the subscription like any other sink event.
+AudioOperationPtr PulseAudioEngine::setCardProfile(uint32_t card, const QString& profile)
+{
+    if (!m_ready)
+        return AudioOperation::failed(QStringLiteral("PulseAudio context not ready"));
+
+    AudioOperationPtr result = AudioOperation::create();
+    PulseAudioOperation* pending = new PulseAudioOperation { this, result };
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_set_card_profile_by_index(m_context, card, profile.toUtf8().constData(), operationSuccessCallback, pending);
+    trackOperation(operation, pending);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    return result;
+}
+
+AudioOperationPtr PulseAudioEngine::setSinkPort(AudioDevice* sink, const QString& port)
+{
+    if (!sink || !m_ready)
+        return AudioOperation::failed(QStringLiteral("PulseAudio context not ready"));
+
+    AudioOperationPtr result = AudioOperation::create();
+    PulseAudioOperation* pending = new PulseAudioOperation { this, result };
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_set_sink_port_by_index(m_context, sink->index(), port.toUtf8().constData(), operationSuccessCallback, pending);
+    trackOperation(operation, pending);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    return result;
+}
+
 void PulseAudioEngine::commitDeviceVolume(AudioDevice* device)
+{
+    commitDeviceVolumeAsync(device);
+}
+
+AudioOperationPtr PulseAudioEngine::commitDeviceVolumeAsync(AudioDevice* device)
 {
     if (!device || !m_ready)
-        return;
+        return AudioOperation::failed(QStringLiteral("PulseAudio context not ready"));
 
     // convert from percentage to real volume value
     pa_volume_t v = ((double)device->volume() / 100.0) * m_maximumVolume;
     pa_cvolume tmpVolume = m_cVolumeMap.value(device);
     pa_cvolume* volume = pa_cvolume_set(&tmpVolume, tmpVolume.channels, v);
     // qDebug() << "PulseAudioEngine::commitDeviceVolume" << v;
+    AudioOperationPtr result = AudioOperation::create();
+    PulseAudioOperation* pending = new PulseAudioOperation { this, result };
+
     pa_threaded_mainloop_lock(m_mainLoop);
 
     pa_operation* operation;
     if (device->type() == Sink)
-        operation = pa_context_set_sink_volume_by_index(m_context, device->index(), volume, contextSuccessCallback, this);
+        operation = pa_context_set_sink_volume_by_index(m_context, device->index(), volume, operationSuccessCallback, pending);
     else
-        operation = pa_context_set_source_volume_by_index(m_context, device->index(), volume, contextSuccessCallback, this);
+        operation = pa_context_set_source_volume_by_index(m_context, device->index(), volume, operationSuccessCallback, pending);
+
+    trackOperation(operation, pending);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    return result;
+}
+
+// Must be called with the mainloop locked, right after issuing the request:
+// pending is then released by operationStateCallback once PA is done with it.
+void PulseAudioEngine::trackOperation(pa_operation* operation, PulseAudioOperation* pending)
+{
+    if (!operation) {
+        pending->result->fail(QString::fromUtf8(pa_strerror(pa_context_errno(m_context))));
+        delete pending;
+        return;
+    }
+    pa_operation_set_state_callback(operation, operationStateCallback, pending);
+
+    // Cancelling the result cancels the request, PA then drops its reply.
+    // The reference is released with the handler, once the request is done
+    // and unlinked from the context.
+    std::shared_ptr<pa_operation> handle(pa_operation_ref(operation), pa_operation_unref);
+    QPointer<PulseAudioEngine> engine(this);
+    pending->result->setCancelHandler([engine, handle] {
+        if (!engine)
+            return;
+
+        pa_threaded_mainloop_lock(engine->mainloop());
+        pa_operation_cancel(handle.get());
+        pa_threaded_mainloop_unlock(engine->mainloop());
+    });
+}
+
+void PulseAudioEngine::retrieveSinks()
+{
+    if (!m_ready)
+        return;
 
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_get_sink_info_list(m_context, sinkInfoCallback, this);
     while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
         pa_threaded_mainloop_wait(m_mainLoop);
     pa_operation_unref(operation);
@@ -255,7 +754,7 @@ void PulseAudioEngine::commitDeviceVolume(AudioDevice* device)
     pa_threaded_mainloop_unlock(m_mainLoop);
 }
 
-void PulseAudioEngine::retrieveSinks()
+void PulseAudioEngine::retrieveCards()
 {
     if (!m_ready)
         return;
@@ -263,7 +762,7 @@ void PulseAudioEngine::retrieveSinks()
     pa_threaded_mainloop_lock(m_mainLoop);
 
     pa_operation* operation;
-    operation = pa_context_get_sink_info_list(m_context, sinkInfoCallback, this);
+    operation = pa_context_get_card_info_list(m_context, cardInfoCallback, this);
     while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
         pa_threaded_mainloop_wait(m_mainLoop);
     pa_operation_unref(operation);
@@ -271,18 +770,285 @@ void PulseAudioEngine::retrieveSinks()
     pa_threaded_mainloop_unlock(m_mainLoop);
 }
 
+void PulseAudioEngine::retrieveSourceOutputs()
+{
+    if (!m_ready)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    m_clientIndex = pa_context_get_index(m_context);
+
+    pa_operation* operation;
+    operation = pa_context_get_source_output_info_list(m_context, sourceOutputInfoCallback, this);
+    while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(m_mainLoop);
+    pa_operation_unref(operation);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+}
+
+// Sink inputs are only followed while there are meters to keep
+pa_subscription_mask_t PulseAudioEngine::subscriptionMask() const
+{
+    int mask = PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_CARD | PA_SUBSCRIPTION_MASK_SOURCE_OUTPUT;
+    if (m_meterUsers > 0)
+        mask |= PA_SUBSCRIPTION_MASK_SINK_INPUT;
+
+    return static_cast<pa_subscription_mask_t>(mask);
+}
+
+// Streams beyond the pool capacity are left unmetered
+static constexpr int MeterCapacity = 64;
+
+void PulseAudioEngine::startStreamMeters()
+{
+    if (m_meterUsers++ > 0)
+        return;
+
+    m_levelPool.reset(new std::atomic<float>[MeterCapacity]);
+    m_freeLevelSlots.clear();
+    for (int i = 0; i < MeterCapacity; ++i) {
+        m_levelPool[i].store(0.0f);
+        m_freeLevelSlots.append(i);
+    }
+    m_meterTimer.start();
+
+    // otherwise done once connected
+    if (m_ready) {
+        setupSubscription();
+        retrieveSinkInputs();
+    }
+}
+
+void PulseAudioEngine::stopStreamMeters()
+{
+    if (m_meterUsers <= 0 || --m_meterUsers > 0)
+        return;
+
+    m_meterTimer.stop();
+    closeStreamMeters();
+    m_streams.clear();
+
+    setupSubscription();
+    m_levelPool.reset();
+    m_freeLevelSlots.clear();
+    emit streamLevelsChanged();
+}
+
+// Called from the mainloop with the lock held
+void PulseAudioEngine::addOrUpdateSinkInput(const pa_sink_input_info* info)
+{
+    // our own streams (e.g. the volume feedback) are not listed
+    if (m_meterUsers <= 0 || (info->client != PA_INVALID_INDEX && info->client == m_clientIndex))
+        return;
+
+    const char* name = pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_NAME);
+    PulseAudioStream& stream = m_streams[info->index];
+    stream.name = QString::fromUtf8(name ? name : info->name);
+    // moves to another sink come as change events
+    stream.sink = info->sink;
+    stream.corked = info->corked;
+    stream.mute = info->mute;
+}
+
+void PulseAudioEngine::removeSinkInput(uint32_t idx)
+{
+    if (!m_streams.remove(idx))
+        return;
+
+    updateStreamMeters();
+    emit streamLevelsChanged();
+}
+
+// Streams are captured only while they play on an active sink. Each capture
+// is a peak detect record stream bound to its sink input, so it only costs a
+// wakeup at 10 Hz and reads the stream alone, not the sink mix.
+void PulseAudioEngine::updateStreamMeters()
+{
+    QMap<uint32_t, uint32_t> wanted; // sink input, its sink
+    for (auto it = m_streams.cbegin(); it != m_streams.cend(); ++it) {
+        const PulseAudioStream& stream = it.value();
+        if (stream.corked || stream.mute || !m_monitorMap.contains(stream.sink))
+            continue;
+
+        auto dev_i = std::find_if(m_sinks.cbegin(), m_sinks.cend(), [&stream](AudioDevice* dev) { return dev->index() == stream.sink; });
+        if (dev_i != m_sinks.cend() && (*dev_i)->isActive())
+            wanted.insert(it.key(), stream.sink);
+    }
+
+    QList<uint32_t> unwanted;
+    for (auto it = m_streamMeters.cbegin(); it != m_streamMeters.cend(); ++it) {
+        auto wanted_i = wanted.find(it.key());
+        if (wanted_i == wanted.end() || wanted_i.value() != it->sink)
+            unwanted.append(it.key());
+        else
+            wanted.erase(wanted_i);
+    }
+    if (wanted.isEmpty() && unwanted.isEmpty())
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+    for (uint32_t sinkInput : qAsConst(unwanted))
+        closeStreamMeter(sinkInput);
+    for (auto it = wanted.cbegin(); it != wanted.cend(); ++it)
+        openStreamMeter(it.key(), it.value());
+    pa_threaded_mainloop_unlock(m_mainLoop);
+}
+
+// With the lock held. The record stream reads the sink monitor, restricted
+// to the sink input, and delivers a single float sample per fragment.
+void PulseAudioEngine::openStreamMeter(uint32_t sinkInput, uint32_t sink)
+{
+    if (!m_levelPool || m_freeLevelSlots.isEmpty() || !m_ready)
+        return;
+
+    static const pa_sample_spec spec = { PA_SAMPLE_FLOAT32NE, 10, 1 };
+    pa_buffer_attr attr {};
+    attr.maxlength = static_cast<uint32_t>(-1);
+    attr.fragsize = sizeof(float);
+
+    pa_stream* stream = pa_stream_new(m_context, "Level meter", &spec, nullptr);
+    if (!stream)
+        return;
+
+    const int slot = m_freeLevelSlots.takeLast();
+    m_levelPool[slot].store(0.0f);
+    pa_stream_set_read_callback(stream, meterReadCallback, &m_levelPool[slot]);
+
+    const QByteArray source = QByteArray::number(m_monitorMap.value(sink));
+    if (pa_stream_set_monitor_stream(stream, sinkInput) < 0
+        || pa_stream_connect_record(stream, source.constData(), &attr,
+                                    static_cast<pa_stream_flags_t>(PA_STREAM_DONT_MOVE | PA_STREAM_PEAK_DETECT
+                                                                   | PA_STREAM_ADJUST_LATENCY))
+            < 0) {
+        pa_stream_unref(stream);
+        m_freeLevelSlots.append(slot);
+        return;
+    }
+    m_streamMeters.insert(sinkInput, PulseAudioStreamMeter { stream, sink, slot });
+}
+
+// With the lock held
+void PulseAudioEngine::closeStreamMeter(uint32_t sinkInput)
+{
+    auto it = m_streamMeters.find(sinkInput);
+    if (it == m_streamMeters.end())
+        return;
+
+    pa_stream_set_read_callback(it->stream, nullptr, nullptr);
+    pa_stream_disconnect(it->stream);
+    pa_stream_unref(it->stream);
+
+    m_freeLevelSlots.append(it->slot);
+    m_streamMeters.erase(it);
+}
+
+void PulseAudioEngine::closeStreamMeters()
+{
+    if (m_streamMeters.isEmpty() || !m_mainLoop)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+    const QList<uint32_t> sinkInputs = m_streamMeters.keys();
+    for (uint32_t sinkInput : sinkInputs)
+        closeStreamMeter(sinkInput);
+    pa_threaded_mainloop_unlock(m_mainLoop);
+}
+
+// Sink state changes are picked up here too, at the meter cadence
+void PulseAudioEngine::collectStreamLevels()
+{
+    if (m_streams.isEmpty() || !m_levelPool)
+        return;
+
+    updateStreamMeters();
+
+    for (auto it = m_streams.begin(); it != m_streams.end(); ++it) {
+        auto meter_i = m_streamMeters.constFind(it.key());
+        it->level = meter_i == m_streamMeters.cend() ? 0.0f
+                                                      : m_levelPool[meter_i->slot].exchange(0.0f, std::memory_order_relaxed);
+    }
+    emit streamLevelsChanged();
+}
+
+void PulseAudioEngine::requestSinkInputUpdate(uint32_t idx)
+{
+    emit sinkInputChanged(idx);
+}
+
+void PulseAudioEngine::requestSinkInputRemoval(uint32_t idx)
+{
+    emit sinkInputRemoved(idx);
+}
+
+void PulseAudioEngine::queueSinkInputInfo(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_streams, idx, [self, idx]() {
+        if (self)
+            self->retrieveSinkInputInfo(idx);
+    });
+}
+
+void PulseAudioEngine::queueSinkInputRemoval(uint32_t idx)
+{
+    QPointer<PulseAudioEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, &m_streams, idx, [self, idx]() {
+        if (self)
+            self->removeSinkInput(idx);
+    });
+}
+
+void PulseAudioEngine::retrieveSinkInputs()
+{
+    if (!m_ready || m_meterUsers <= 0)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_get_sink_input_info_list(m_context, sinkInputInfoCallback, this);
+    while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(m_mainLoop);
+    pa_operation_unref(operation);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    updateStreamMeters();
+    emit streamLevelsChanged();
+}
+
+void PulseAudioEngine::retrieveSinkInputInfo(uint32_t idx)
+{
+    if (!m_ready || m_meterUsers <= 0)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_get_sink_input_info(m_context, idx, sinkInputInfoCallback, this);
+    while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(m_mainLoop);
+    pa_operation_unref(operation);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    updateStreamMeters();
+    emit streamLevelsChanged();
+}
+
 void PulseAudioEngine::setupSubscription()
 {
     if (!m_ready)
         return;
 
-    connect(this, &PulseAudioEngine::sinkInfoChanged, this, &PulseAudioEngine::retrieveSinkInfo, Qt::QueuedConnection);
     pa_context_set_subscribe_callback(m_context, contextSubscriptionCallback, this);
 
     pa_threaded_mainloop_lock(m_mainLoop);
 
     pa_operation* operation;
-    operation = pa_context_subscribe(m_context, PA_SUBSCRIPTION_MASK_SINK, contextSuccessCallback, this);
+    operation = pa_context_subscribe(m_context, subscriptionMask(), contextSuccessCallback, this);
     while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
         pa_threaded_mainloop_wait(m_mainLoop);
     pa_operation_unref(operation);
@@ -294,6 +1060,7 @@ void PulseAudioEngine::handleContextStateChanged()
 {
     if (m_contextState == PA_CONTEXT_FAILED || m_contextState == PA_CONTEXT_TERMINATED) {
         qWarning("LXQt-Volume: Context connection failed or terminated lets try to reconnect");
+        clearSourceOutputs();
         m_reconnectionTimer.start();
     }
 }
@@ -308,6 +1075,13 @@ void PulseAudioEngine::connectContext()
     if (!m_mainLoop)
         return;
 
+    // the streams went away with the previous context
+    closeStreamMeters();
+    if (!m_streams.isEmpty()) {
+        m_streams.clear();
+        emit streamLevelsChanged();
+    }
+
     pa_threaded_mainloop_lock(m_mainLoop);
 
     if (m_context) {
@@ -361,7 +1135,11 @@ void PulseAudioEngine::connectContext()
 
     if (ok) {
         retrieveSinks();
+        retrieveCards();
+        clearSourceOutputs();
+        retrieveSourceOutputs();
         setupSubscription();
+        retrieveSinkInputs();
     } else {
         m_reconnectionTimer.start();
     }
@@ -383,7 +1161,7 @@ void PulseAudioEngine::retrieveSinkInfo(uint32_t idx)
     pa_threaded_mainloop_unlock(m_mainLoop);
 }
 
-void PulseAudioEngine::setMute(AudioDevice* device, bool state)
+void PulseAudioEngine::retrieveCardInfo(uint32_t idx)
 {
     if (!m_ready)
         return;
@@ -391,7 +1169,7 @@ void PulseAudioEngine::setMute(AudioDevice* device, bool state)
     pa_threaded_mainloop_lock(m_mainLoop);
 
     pa_operation* operation;
-    operation = pa_context_set_sink_mute_by_index(m_context, device->index(), state, contextSuccessCallback, this);
+    operation = pa_context_get_card_info_by_index(m_context, idx, cardInfoCallback, this);
     while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
         pa_threaded_mainloop_wait(m_mainLoop);
     pa_operation_unref(operation);
@@ -399,6 +1177,145 @@ void PulseAudioEngine::setMute(AudioDevice* device, bool state)
     pa_threaded_mainloop_unlock(m_mainLoop);
 }
 
+// The click is synthesized in the sink sample format when we can produce it,
+// the stream buffer holds exactly one click and stays corked while idle.
+void PulseAudioEngine::openFeedback(AudioDevice* device)
+{
+    if (m_feedbackStream && device == m_feedbackDevice)
+        return;
+
+    closeFeedback();
+    if (!m_ready || !device)
+        return;
+
+    pa_sample_spec spec = m_specMap.value(device);
+    if (!pa_sample_spec_valid(&spec))
+        spec = pa_sample_spec { PA_SAMPLE_S16NE, 48000, 2 };
+
+    AudioFeedback::SampleFormat format = AudioFeedback::Int16;
+    if (spec.format == PA_SAMPLE_FLOAT32NE)
+        format = AudioFeedback::Float32;
+    else if (spec.format == PA_SAMPLE_S32NE)
+        format = AudioFeedback::Int32;
+    else
+        spec.format = PA_SAMPLE_S16NE;
+
+    m_feedbackSample = AudioFeedback::click(format, spec.rate, spec.channels);
+
+    pa_buffer_attr attr;
+    attr.maxlength = static_cast<uint32_t>(-1);
+    attr.tlength = m_feedbackSample.size();
+    attr.prebuf = static_cast<uint32_t>(-1);
+    attr.minreq = static_cast<uint32_t>(-1);
+    attr.fragsize = static_cast<uint32_t>(-1);
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+    m_feedbackStream = pa_stream_new(m_context, "Volume feedback", &spec, nullptr);
+    if (m_feedbackStream
+        && pa_stream_connect_playback(m_feedbackStream, device->name().toUtf8().constData(), &attr,
+                                      static_cast<pa_stream_flags_t>(PA_STREAM_START_CORKED | PA_STREAM_ADJUST_LATENCY),
+                                      nullptr, nullptr) < 0) {
+        qWarning() << "Feedback stream:" << pa_strerror(pa_context_errno(m_context));
+        pa_stream_unref(m_feedbackStream);
+        m_feedbackStream = nullptr;
+    }
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    if (!m_feedbackStream)
+        return;
+
+    m_feedbackDevice = device;
+}
+
+void PulseAudioEngine::closeFeedback()
+{
+    m_feedbackTimer.stop();
+    m_feedbackDevice = nullptr;
+    if (!m_feedbackStream)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+    pa_stream_disconnect(m_feedbackStream);
+    pa_stream_unref(m_feedbackStream);
+    m_feedbackStream = nullptr;
+    pa_threaded_mainloop_unlock(m_mainLoop);
+}
+
+// Written at the read index, so a click still playing is restarted
+// rather than followed by another one. The data is copied straight
+// into the stream's own buffer.
+void PulseAudioEngine::playFeedback(AudioDevice* device)
+{
+    if (!m_feedbackStream || device != m_feedbackDevice)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+    if (pa_stream_get_state(m_feedbackStream) == PA_STREAM_READY) {
+        size_t offset = 0;
+        pa_seek_mode_t seek = PA_SEEK_RELATIVE_ON_READ;
+        const size_t size = m_feedbackSample.size();
+
+        while (offset < size) {
+            void* data;
+            size_t bytes = size - offset;
+            if (pa_stream_begin_write(m_feedbackStream, &data, &bytes) < 0 || bytes == 0)
+                break;
+
+            bytes = qMin(bytes, size - offset);
+            std::memcpy(data, m_feedbackSample.constData() + offset, bytes);
+            pa_stream_write(m_feedbackStream, data, bytes, nullptr, 0, seek);
+            offset += bytes;
+            seek = PA_SEEK_RELATIVE;
+        }
+        if (pa_stream_is_corked(m_feedbackStream) == 1) {
+            if (pa_operation* operation = pa_stream_cork(m_feedbackStream, 0, nullptr, nullptr))
+                pa_operation_unref(operation);
+        }
+    }
+    pa_threaded_mainloop_unlock(m_mainLoop);
+    m_feedbackTimer.start();
+}
+
+void PulseAudioEngine::retrieveSourceOutputInfo(uint32_t idx)
+{
+    if (!m_ready)
+        return;
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_get_source_output_info(m_context, idx, sourceOutputInfoCallback, this);
+    while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(m_mainLoop);
+    pa_operation_unref(operation);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+}
+
+void PulseAudioEngine::setMute(AudioDevice* device, bool state)
+{
+    setMuteAsync(device, state);
+}
+
+AudioOperationPtr PulseAudioEngine::setMuteAsync(AudioDevice* device, bool state)
+{
+    if (!device || !m_ready)
+        return AudioOperation::failed(QStringLiteral("PulseAudio context not ready"));
+
+    AudioOperationPtr result = AudioOperation::create();
+    PulseAudioOperation* pending = new PulseAudioOperation { this, result };
+
+    pa_threaded_mainloop_lock(m_mainLoop);
+
+    pa_operation* operation;
+    operation = pa_context_set_sink_mute_by_index(m_context, device->index(), state, operationSuccessCallback, pending);
+    trackOperation(operation, pending);
+
+    pa_threaded_mainloop_unlock(m_mainLoop);
+
+    return result;
+}
+
 void PulseAudioEngine::setContextState(pa_context_state_t state)
 {
     if (m_contextState == state)
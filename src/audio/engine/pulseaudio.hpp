@@ -29,19 +29,62 @@
 
 #include "audio/engine.hpp"
 
+#include <QByteArray>
 #include <QObject>
 #include <QList>
+#include <QPointer>
 #include <QTimer>
 #include <QMap>
 
 #include <pulse/pulseaudio.h>
 
+#include <atomic>
+#include <memory>
+
 // PA_VOLUME_UI_MAX is only supported since pulseaudio 0.9.23
 #ifndef PA_VOLUME_UI_MAX
 #define PA_VOLUME_UI_MAX (pa_sw_volume_from_dB(+11.0))
 #endif
 
 class AudioDevice;
+struct PulseAudioOperation;
+
+// A selectable card profile or sink port
+struct PulseAudioChoice {
+    QString name;
+    QString description;
+    bool available;
+};
+
+struct PulseAudioCard {
+    uint32_t index;
+    QString name;
+    QString description;
+    QString activeProfile;
+    QList<PulseAudioChoice> profiles;
+};
+
+struct PulseAudioSinkPorts {
+    uint32_t card;
+    QString activePort;
+    QList<PulseAudioChoice> ports;
+};
+
+// A playback stream (sink input) as shown in the stream list
+struct PulseAudioStream {
+    QString name;
+    uint32_t sink;
+    bool corked;
+    bool mute;
+    float level;
+};
+
+// One peak capture of a single sink input, through its sink monitor
+struct PulseAudioStreamMeter {
+    pa_stream* stream;
+    uint32_t sink; // reopened when the sink input moves
+    int slot; // in the shared level pool
+};
 
 class PulseAudioEngine : public AudioEngine {
     Q_OBJECT
@@ -54,35 +97,106 @@ public:
 
     int volumeMax(AudioDevice* /*device*/) const { return m_maximumVolume; }
 
+    void openFeedback(AudioDevice* device) override;
+    void closeFeedback() override;
+    void playFeedback(AudioDevice* device) override;
+
     void requestSinkInfoUpdate(uint32_t idx);
+    void requestSinkRemoval(uint32_t idx);
     void removeSink(uint32_t idx);
     void addOrUpdateSink(const pa_sink_info* info);
 
+    void requestCardInfoUpdate(uint32_t idx);
+    void requestCardRemoval(uint32_t idx);
+    void removeCard(uint32_t idx);
+    void addOrUpdateCard(const pa_card_info* info);
+
+    void requestSourceOutputUpdate(uint32_t idx);
+    void requestSourceOutputRemoval(uint32_t idx);
+    void removeSourceOutput(uint32_t idx);
+    void addOrUpdateSourceOutput(const pa_source_output_info* info);
+    int recordingStreams() const override { return m_sourceOutputs.count(); }
+    int recordingStreams(uint32_t source) const { return m_recordingMap.value(source); }
+
+    // Playback streams (sink inputs) and their peak levels. Streams are only
+    // followed between the first start and the last stop, e.g. while a stream
+    // list is shown. Each playing stream gets its own peak capture, streams
+    // that are corked, muted or on an idle sink read 0.
+    void startStreamMeters();
+    void stopStreamMeters();
+    const QMap<uint32_t, PulseAudioStream>& streams() const { return m_streams; }
+    void requestSinkInputUpdate(uint32_t idx);
+    void requestSinkInputRemoval(uint32_t idx);
+    void addOrUpdateSinkInput(const pa_sink_input_info* info);
+    void removeSinkInput(uint32_t idx);
+
+    // Served from the local cache, kept current by subscription events
+    const PulseAudioCard* cardOf(AudioDevice* sink) const;
+    const PulseAudioSinkPorts* portsOf(AudioDevice* sink) const;
+    AudioDevice* sinkOfCard(uint32_t card) const;
+
+    AudioOperationPtr setCardProfile(uint32_t card, const QString& profile);
+    AudioOperationPtr setSinkPort(AudioDevice* sink, const QString& port);
+
     pa_context_state_t contextState() const { return m_contextState; }
     bool ready() const { return m_ready; }
     pa_threaded_mainloop* mainloop() const { return m_mainLoop; }
 
     void setNormalized(bool);
 
+    AudioOperationPtr commitDeviceVolumeAsync(AudioDevice* device) override;
+    AudioOperationPtr setMuteAsync(AudioDevice* device, bool state) override;
+
 public slots:
     void commitDeviceVolume(AudioDevice* device);
     void retrieveSinkInfo(uint32_t idx);
+    void retrieveCardInfo(uint32_t idx);
+    void retrieveSourceOutputInfo(uint32_t idx);
+    void retrieveSinkInputInfo(uint32_t idx);
     void setMute(AudioDevice* device, bool state);
     void setContextState(pa_context_state_t state);
     void setIgnoreMaxVolume(bool ignore);
 
 signals:
     void sinkInfoChanged(uint32_t idx);
+    void sinkRemoved(uint32_t idx);
+    void cardInfoChanged(uint32_t idx);
+    void cardRemoved(uint32_t idx);
+    void sourceOutputChanged(uint32_t idx);
+    void sourceOutputRemoved(uint32_t idx);
+    void sinkInputChanged(uint32_t idx);
+    void sinkInputRemoved(uint32_t idx);
+    void streamLevelsChanged();
     void contextStateChanged(pa_context_state_t state);
     void readyChanged(bool ready);
 
 private slots:
     void handleContextStateChanged();
     void connectContext();
+    void queueSinkInfo(uint32_t idx);
+    void queueSinkRemoval(uint32_t idx);
+    void queueCardInfo(uint32_t idx);
+    void queueCardRemoval(uint32_t idx);
+    void queueSourceOutputInfo(uint32_t idx);
+    void queueSourceOutputRemoval(uint32_t idx);
+    void queueSinkInputInfo(uint32_t idx);
+    void queueSinkInputRemoval(uint32_t idx);
+    void collectStreamLevels();
 
 private:
     void retrieveSinks();
+    void retrieveCards();
+    void retrieveSourceOutputs();
+    void retrieveSinkInputs();
+    void updateStreamMeters();
+    void openStreamMeter(uint32_t sinkInput, uint32_t sink);
+    void closeStreamMeter(uint32_t sinkInput);
+    void closeStreamMeters();
+    void clearSourceOutputs();
+    bool isRecording(const pa_source_output_info* info) const;
+    pa_subscription_mask_t subscriptionMask() const;
     void setupSubscription();
+    void trackOperation(pa_operation* operation, PulseAudioOperation* pending);
 
     pa_mainloop_api* m_mainLoopApi;
     pa_threaded_mainloop* m_mainLoop;
@@ -94,4 +208,22 @@ private:
     int m_maximumVolume;
 
     QMap<AudioDevice*, pa_cvolume> m_cVolumeMap;
+    QMap<AudioDevice*, PulseAudioSinkPorts> m_portsMap;
+    QMap<uint32_t, PulseAudioCard> m_cards;
+    QMap<AudioDevice*, pa_sample_spec> m_specMap;
+    pa_stream* m_feedbackStream;
+    QPointer<AudioDevice> m_feedbackDevice;
+    QByteArray m_feedbackSample;
+    QTimer m_feedbackTimer;
+    QMap<uint32_t, uint32_t> m_monitorMap; // sink index, its monitor source index
+    QMap<uint32_t, PulseAudioStream> m_streams; // sink input index
+    QMap<uint32_t, PulseAudioStreamMeter> m_streamMeters; // sink input index
+    // Written by the mainloop read callbacks, collected at one common cadence
+    std::unique_ptr<std::atomic<float>[]> m_levelPool;
+    QList<int> m_freeLevelSlots;
+    QTimer m_meterTimer;
+    int m_meterUsers;
+    uint32_t m_clientIndex;
+    QMap<uint32_t, uint32_t> m_sourceOutputs; // source output, source it records from
+    QMap<uint32_t, int> m_recordingMap; // source, source outputs count
 };
@@ -0,0 +1,441 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/engine/remote.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/remoteprotocol.hpp"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QPointer>
+#include <QSocketNotifier>
+#include <QtDebug>
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using AudioRemote::Command;
+using AudioRemote::Event;
+using AudioRemote::SharedBlock;
+
+namespace {
+// Time the helper has to answer a request before it is considered hung
+constexpr int responseTimeout = 3000;
+// A helper running that long is considered healthy again
+constexpr int stableUptime = 10000;
+constexpr int maxRestartDelay = 5000;
+
+void wake(int fd)
+{
+    const quint64 one = 1;
+    if (write(fd, &one, sizeof(one)) < 0)
+        qWarning("RemoteEngine: cannot wake the other side: %s", strerror(errno));
+}
+
+void clear(int fd)
+{
+    quint64 count;
+    while (read(fd, &count, sizeof(count)) > 0) { }
+}
+} // namespace
+
+RemoteDevice::RemoteDevice(quint32 remoteId, AudioEngine* engine, QObject* parent)
+    : AudioDevice(Sink, engine, parent)
+    , m_remoteId(remoteId)
+{
+}
+
+RemoteEngine::RemoteEngine(int backendId, QObject* parent)
+    : AudioEngine(parent)
+    , m_backendId(backendId)
+    , m_recordingStreams(0)
+    , m_ignoreMaxVolume(false)
+    , m_restarts(0)
+    , m_shmFd(-1)
+    , m_commandFd(-1)
+    , m_eventFd(-1)
+    , m_block(nullptr)
+    , m_eventNotifier(nullptr)
+    , m_serial(0)
+{
+    m_restartTimer.setSingleShot(true);
+    connect(&m_restartTimer, &QTimer::timeout, this, &RemoteEngine::startHelper);
+
+    m_watchdog.setSingleShot(true);
+    m_watchdog.setInterval(responseTimeout);
+    connect(&m_watchdog, &QTimer::timeout, this, [this]() {
+        if (m_pending.isEmpty())
+            return;
+
+        qWarning("RemoteEngine: engine helper not responding, killing it");
+        m_process.kill();
+    });
+
+    m_process.setProcessChannelMode(QProcess::ForwardedChannels);
+    connect(&m_process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, &RemoteEngine::onHelperFinished);
+    connect(&m_process, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            qWarning("RemoteEngine: cannot start %s", qPrintable(helperPath()));
+            onHelperFinished();
+        }
+    });
+
+    if (createChannel())
+        startHelper();
+}
+
+RemoteEngine::~RemoteEngine()
+{
+    disconnect(&m_process, nullptr, this, nullptr);
+    if (m_process.state() != QProcess::NotRunning) {
+        Command command {};
+        command.type = Command::Quit;
+        if (m_block->commands.push(command))
+            wake(m_commandFd);
+
+        if (!m_process.waitForFinished(500)) {
+            m_process.kill();
+            m_process.waitForFinished(500);
+        }
+    }
+    const QList<AudioOperationPtr> pending = m_pending.values();
+    m_pending.clear();
+    for (const AudioOperationPtr& operation : pending)
+        operation->cancel();
+
+    if (m_block)
+        munmap(m_block, sizeof(SharedBlock));
+
+    for (int fd : { m_shmFd, m_commandFd, m_eventFd }) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+// Next to the tray executable when running from the build directory
+QString RemoteEngine::helperPath()
+{
+    const QString local = QCoreApplication::applicationDirPath() + QLatin1Char('/')
+                          + QFileInfo(QStringLiteral(ENGINE_HELPER_PATH)).fileName();
+    if (QFileInfo(local).isExecutable())
+        return local;
+
+    return QStringLiteral(ENGINE_HELPER_PATH);
+}
+
+// The descriptors are inherited by the helper, hence no CLOEXEC
+bool RemoteEngine::createChannel()
+{
+    m_shmFd = memfd_create("voltrayke-engine", 0);
+    if (m_shmFd < 0 || ftruncate(m_shmFd, sizeof(SharedBlock)) < 0) {
+        qWarning("RemoteEngine: cannot create shared memory: %s", strerror(errno));
+        return false;
+    }
+    void* memory = mmap(nullptr, sizeof(SharedBlock), PROT_READ | PROT_WRITE, MAP_SHARED, m_shmFd, 0);
+    if (memory == MAP_FAILED) {
+        qWarning("RemoteEngine: cannot map shared memory: %s", strerror(errno));
+        return false;
+    }
+    m_commandFd = eventfd(0, EFD_NONBLOCK);
+    m_eventFd = eventfd(0, EFD_NONBLOCK);
+    if (m_commandFd < 0 || m_eventFd < 0) {
+        qWarning("RemoteEngine: cannot create event descriptors: %s", strerror(errno));
+        munmap(memory, sizeof(SharedBlock));
+        return false;
+    }
+    m_block = new (memory) SharedBlock;
+
+    m_eventNotifier = new QSocketNotifier(m_eventFd, QSocketNotifier::Read, this);
+    connect(m_eventNotifier, &QSocketNotifier::activated, this, &RemoteEngine::onEventsReady);
+    return true;
+}
+
+void RemoteEngine::startHelper()
+{
+    // Nothing reads or writes the rings while no helper runs
+    m_block->reset();
+    clear(m_commandFd);
+    clear(m_eventFd);
+
+    // Picked up by the helper before anything else
+    Command command {};
+    command.type = Command::SetNormalized;
+    command.value = m_isNormalized;
+    m_block->commands.push(command);
+    command.type = Command::SetIgnoreMaxVolume;
+    command.value = m_ignoreMaxVolume;
+    m_block->commands.push(command);
+    wake(m_commandFd);
+
+    m_process.start(helperPath(), {
+                                      QString::number(m_backendId),
+                                      QString::number(m_shmFd),
+                                      QString::number(m_commandFd),
+                                      QString::number(m_eventFd),
+                                  });
+    m_uptime.start();
+}
+
+void RemoteEngine::onHelperFinished()
+{
+    m_watchdog.stop();
+    const QList<AudioOperationPtr> pending = m_pending.values();
+    m_pending.clear();
+    for (const AudioOperationPtr& operation : pending)
+        operation->fail(tr("The engine helper exited"));
+
+    // Devices stay, so tray items keep their binding until the new helper
+    // reports them again or tells they are gone
+    for (RemoteDevice* dev : qAsConst(m_devices))
+        m_stale.insert(dev);
+    m_devices.clear();
+
+    if (m_uptime.isValid() && m_uptime.elapsed() > stableUptime)
+        m_restarts = 0;
+
+    const int delay = qMin(100 << qMin(m_restarts, 6), maxRestartDelay);
+    ++m_restarts;
+    qWarning("RemoteEngine: engine helper exited, restarting in %d ms", delay);
+    m_restartTimer.start(delay);
+}
+
+void RemoteEngine::onEventsReady()
+{
+    clear(m_eventFd);
+
+    QPointer<RemoteEngine> self(this);
+    AudioDispatcher::instance()->post(AudioDispatcher::Backend, this, 0, [self]() {
+        if (self)
+            self->drainEvents();
+    });
+}
+
+void RemoteEngine::drainEvents()
+{
+    bool listChanged = false;
+    Event event;
+    while (m_block->events.pop(&event)) {
+        switch (event.type) {
+        case Event::Update: {
+            RemoteDevice* dev = m_devices.value(event.device);
+            if (!dev) {
+                const QString key = QString::fromUtf8(event.key);
+                // Reported again by a restarted helper, or under a new id
+                // after the helper dropped it: the device is kept
+                dev = static_cast<RemoteDevice*>(sinkByKey(key));
+                if (dev) {
+                    m_stale.remove(dev);
+                    if (m_devices.value(dev->remoteId()) == dev)
+                        m_devices.remove(dev->remoteId());
+                    dev->setRemoteId(event.device);
+                    if (m_usedKeys.contains(key))
+                        useDevice(dev);
+                    if (dev == m_feedbackDevice)
+                        postCommand(Command::OpenFeedback, dev);
+                } else {
+                    dev = new RemoteDevice(event.device, this);
+                    dev->setKey(key);
+                    m_sinks.append(dev);
+                    listChanged = true;
+                }
+                m_devices.insert(event.device, dev);
+            }
+            dev->setName(QString::fromUtf8(event.name));
+            dev->setDescription(QString::fromUtf8(event.description));
+            dev->setState(static_cast<AudioDevice::State>(event.state));
+            dev->setBound(event.bound);
+            dev->setMuteNoCommit(event.mute);
+            dev->setVolumeNoCommit(event.volume);
+            break;
+        }
+        case Event::Remove:
+            if (RemoteDevice* dev = m_devices.take(event.device)) {
+                m_sinks.removeAll(dev);
+                delete dev;
+                listChanged = true;
+            }
+            break;
+        case Event::ListDone:
+            if (!m_stale.isEmpty()) {
+                removeStaleDevices();
+                listChanged = true;
+            }
+            break;
+        case Event::Done:
+            if (AudioOperationPtr operation = m_pending.take(event.serial)) {
+                if (event.failed)
+                    operation->fail(tr("The engine could not apply the change"));
+                else
+                    operation->finish();
+            }
+            break;
+        case Event::Recording:
+            if (m_recordingStreams != event.volume) {
+                m_recordingStreams = event.volume;
+                emit recordingStreamsChanged(m_recordingStreams);
+            }
+            break;
+        }
+    }
+    if (m_pending.isEmpty())
+        m_watchdog.stop();
+    else
+        m_watchdog.start();
+
+    if (listChanged)
+        emit sinkListChanged();
+}
+
+void RemoteEngine::removeStaleDevices()
+{
+    for (RemoteDevice* dev : qAsConst(m_stale)) {
+        m_sinks.removeAll(dev);
+        delete dev;
+    }
+    m_stale.clear();
+}
+
+AudioOperationPtr RemoteEngine::sendCommand(int type, AudioDevice* device, int value)
+{
+    RemoteDevice* dev = qobject_cast<RemoteDevice*>(device);
+    if (!dev || m_stale.contains(dev))
+        return AudioOperation::failed(tr("The device is not available"));
+
+    Command command {};
+    command.type = static_cast<Command::Type>(type);
+    command.device = dev->remoteId();
+    command.value = value;
+    command.serial = ++m_serial;
+    if (!m_block || !m_block->commands.push(command))
+        return AudioOperation::failed(tr("The engine helper is not responding"));
+
+    wake(m_commandFd);
+
+    AudioOperationPtr operation = AudioOperation::create();
+    m_pending.insert(command.serial, operation);
+    if (!m_watchdog.isActive())
+        m_watchdog.start();
+
+    return operation;
+}
+
+AudioOperationPtr RemoteEngine::commitDeviceVolumeAsync(AudioDevice* device)
+{
+    return sendCommand(Command::SetVolume, device, device->volume());
+}
+
+AudioOperationPtr RemoteEngine::setMuteAsync(AudioDevice* device, bool state)
+{
+    return sendCommand(Command::SetMute, device, state);
+}
+
+void RemoteEngine::commitDeviceVolume(AudioDevice* device)
+{
+    commitDeviceVolumeAsync(device);
+}
+
+void RemoteEngine::setMute(AudioDevice* device, bool state)
+{
+    setMuteAsync(device, state);
+}
+
+void RemoteEngine::useDevice(AudioDevice* device)
+{
+    RemoteDevice* dev = qobject_cast<RemoteDevice*>(device);
+    if (!dev)
+        return;
+
+    m_usedKeys.insert(dev->key());
+    postCommand(Command::UseDevice, dev);
+}
+
+void RemoteEngine::openFeedback(AudioDevice* device)
+{
+    RemoteDevice* dev = qobject_cast<RemoteDevice*>(device);
+    if (!dev || dev == m_feedbackDevice)
+        return;
+
+    m_feedbackDevice = dev;
+    postCommand(Command::OpenFeedback, dev);
+}
+
+void RemoteEngine::closeFeedback()
+{
+    if (!m_feedbackDevice)
+        return;
+
+    m_feedbackDevice = nullptr;
+    if (!m_block)
+        return;
+
+    Command command {};
+    command.type = Command::CloseFeedback;
+    if (m_block->commands.push(command))
+        wake(m_commandFd);
+}
+
+void RemoteEngine::playFeedback(AudioDevice* device)
+{
+    postCommand(Command::PlayFeedback, qobject_cast<RemoteDevice*>(device));
+}
+
+// Fire and forget, nothing is sent for devices the helper doesn't know
+void RemoteEngine::postCommand(int type, RemoteDevice* device)
+{
+    if (!device || m_stale.contains(device) || !m_block)
+        return;
+
+    Command command {};
+    command.type = static_cast<Command::Type>(type);
+    command.device = device->remoteId();
+    if (m_block->commands.push(command))
+        wake(m_commandFd);
+}
+
+void RemoteEngine::setNormalized(bool normalized)
+{
+    m_isNormalized = normalized;
+    if (!m_block)
+        return;
+
+    Command command {};
+    command.type = Command::SetNormalized;
+    command.value = normalized;
+    if (m_block->commands.push(command))
+        wake(m_commandFd);
+}
+
+void RemoteEngine::setIgnoreMaxVolume(bool ignore)
+{
+    m_ignoreMaxVolume = ignore;
+    if (!m_block)
+        return;
+
+    Command command {};
+    command.type = Command::SetIgnoreMaxVolume;
+    command.value = ignore;
+    if (m_block->commands.push(command))
+        wake(m_commandFd);
+}
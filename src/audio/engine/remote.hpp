@@ -0,0 +1,125 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include "audio/device.hpp"
+#include "audio/engine.hpp"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QProcess>
+#include <QSet>
+#include <QTimer>
+
+class QSocketNotifier;
+
+namespace AudioRemote {
+struct SharedBlock;
+}
+
+class RemoteDevice : public AudioDevice {
+    Q_OBJECT
+
+public:
+    RemoteDevice(quint32 remoteId, AudioEngine* engine, QObject* parent = nullptr);
+
+    QString key() const override { return m_key; }
+    void setKey(const QString& key) { m_key = key; }
+
+    // Changes on every helper restart, the key does not
+    quint32 remoteId() const { return m_remoteId; }
+    void setRemoteId(quint32 id) { m_remoteId = id; }
+
+private:
+    quint32 m_remoteId;
+    QString m_key;
+};
+
+// Proxy for an engine running in the engine helper process, so a wedged
+// sound server or driver can't freeze the tray. Devices and volumes are
+// mirrored from the helper, a helper that dies or stops answering gets
+// restarted and its devices are matched back by key.
+// Only the AudioEngine interface is proxied: what the tray gets from a
+// PulseAudioEngine directly (card profiles, ports, the stream list and its
+// meters) is not available through the helper.
+class RemoteEngine : public AudioEngine {
+    Q_OBJECT
+
+public:
+    RemoteEngine(int backendId, QObject* parent = nullptr);
+    ~RemoteEngine();
+
+    // Same id as the hosted engine, settings don't tell them apart
+    int id() const { return m_backendId; }
+    int volumeMax(AudioDevice*) const { return 100; }
+    void setNormalized(bool);
+    int recordingStreams() const { return m_recordingStreams; }
+    void useDevice(AudioDevice* device) override;
+    // False when the shared block could not be set up, no helper runs then
+    bool hasChannel() const { return m_block != nullptr; }
+
+    AudioOperationPtr commitDeviceVolumeAsync(AudioDevice* device) override;
+    AudioOperationPtr setMuteAsync(AudioDevice* device, bool state) override;
+
+    // Played by the helper, the feedback stream is opened again on restart
+    void openFeedback(AudioDevice* device) override;
+    void closeFeedback() override;
+    void playFeedback(AudioDevice* device) override;
+
+    static QString helperPath();
+
+public slots:
+    void commitDeviceVolume(AudioDevice* device);
+    void setMute(AudioDevice* device, bool state);
+    void setIgnoreMaxVolume(bool ignore) override;
+
+private:
+    bool createChannel();
+    void startHelper();
+    void onHelperFinished();
+    void onEventsReady();
+    void drainEvents();
+    void removeStaleDevices();
+    AudioOperationPtr sendCommand(int type, AudioDevice* device, int value);
+    void postCommand(int type, RemoteDevice* device);
+
+    int m_backendId;
+    int m_recordingStreams;
+    bool m_ignoreMaxVolume;
+    int m_restarts;
+    int m_shmFd;
+    int m_commandFd;
+    int m_eventFd;
+    AudioRemote::SharedBlock* m_block;
+    QSocketNotifier* m_eventNotifier;
+    QProcess m_process;
+    QElapsedTimer m_uptime;
+    QTimer m_restartTimer;
+    QTimer m_watchdog;
+    quint64 m_serial;
+    QHash<quint64, AudioOperationPtr> m_pending;
+    QHash<quint32, RemoteDevice*> m_devices;
+    // Devices of a previous helper instance not reported again yet
+    QSet<RemoteDevice*> m_stale;
+    // keys of the used devices, told again to a restarted helper
+    QSet<QString> m_usedKeys;
+    QPointer<RemoteDevice> m_feedbackDevice;
+};
@@ -0,0 +1,53 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/feedback.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+QByteArray AudioFeedback::click(SampleFormat format, unsigned rate, unsigned channels)
+{
+    const int frames = rate * DurationMs / 1000;
+    const int sampleSize = format == Int16 ? 2 : 4;
+    QByteArray data(frames * channels * sampleSize, Qt::Uninitialized);
+    char* out = data.data();
+
+    // 2 kHz tone fading out in a couple of milliseconds
+    for (int i = 0; i < frames; ++i) {
+        const double t = static_cast<double>(i) / rate;
+        const double value = 0.5 * std::sin(2.0 * M_PI * 2000.0 * t) * std::exp(-t / 0.002);
+
+        for (unsigned c = 0; c < channels; ++c) {
+            if (format == Int16) {
+                const qint16 sample = static_cast<qint16>(value * std::numeric_limits<qint16>::max());
+                std::memcpy(out, &sample, sizeof(sample));
+            } else if (format == Int32) {
+                const qint32 sample = static_cast<qint32>(value * std::numeric_limits<qint32>::max());
+                std::memcpy(out, &sample, sizeof(sample));
+            } else {
+                const float sample = static_cast<float>(value);
+                std::memcpy(out, &sample, sizeof(sample));
+            }
+            out += sampleSize;
+        }
+    }
+    return data;
+}
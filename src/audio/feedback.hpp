@@ -0,0 +1,37 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QByteArray>
+
+// The click played on volume steps. It is synthesized once in the format
+// of the stream it goes to, so playing it is a plain copy.
+class AudioFeedback {
+public:
+    enum SampleFormat {
+        Int16,
+        Int32,
+        Float32
+    };
+    static constexpr int DurationMs = 12;
+
+    // Native endian interleaved samples
+    static QByteArray click(SampleFormat format, unsigned rate, unsigned channels);
+};
@@ -0,0 +1,46 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/health.hpp"
+
+void AudioHealth::record(const AudioHealthSample& sample)
+{
+    if (m_count < Capacity) {
+        m_samples[(m_first + m_count) % Capacity] = sample;
+        ++m_count;
+    } else {
+        m_samples[m_first] = sample;
+        m_first = (m_first + 1) % Capacity;
+    }
+}
+
+const AudioHealthSample& AudioHealth::at(int i) const
+{
+    Q_ASSERT(i >= 0 && i < m_count);
+    return m_samples[(m_first + i) % Capacity];
+}
+
+quint64 AudioHealth::maxLatency() const
+{
+    quint64 latency = 0;
+    for (int i = 0; i < m_count; ++i)
+        latency = qMax(latency, at(i).latency);
+
+    return latency;
+}
@@ -0,0 +1,52 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QtGlobal>
+
+#include <array>
+
+struct AudioHealthSample {
+    qint64 timestamp = 0; // msecs since epoch
+    quint64 latency = 0; // usecs, current output latency
+    quint64 configuredLatency = 0; // usecs, latency the device was set up for
+    quint32 xruns = 0; // under/overruns seen so far, engines sampling the state give a lower bound
+};
+
+// Small ring of the most recent audio path samples of a device.
+// Samples are recorded on backend events or at a slow rate, never polled.
+class AudioHealth {
+public:
+    static constexpr int Capacity = 16;
+
+    void record(const AudioHealthSample& sample);
+
+    bool isEmpty() const { return m_count == 0; }
+    int count() const { return m_count; }
+    // 0 is the oldest sample still kept, count() - 1 the latest
+    const AudioHealthSample& at(int i) const;
+    const AudioHealthSample& last() const { return at(m_count - 1); }
+    quint64 maxLatency() const;
+
+private:
+    std::array<AudioHealthSample, Capacity> m_samples;
+    int m_first = 0;
+    int m_count = 0;
+};
@@ -0,0 +1,129 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/operation.hpp"
+
+AudioOperation::AudioOperation()
+    : m_state(Running)
+{
+}
+
+AudioOperationPtr AudioOperation::create()
+{
+    return AudioOperationPtr(new AudioOperation);
+}
+
+AudioOperationPtr AudioOperation::finished()
+{
+    AudioOperationPtr op = create();
+    op->finish();
+    return op;
+}
+
+AudioOperationPtr AudioOperation::failed(const QString& error)
+{
+    AudioOperationPtr op = create();
+    op->fail(error);
+    return op;
+}
+
+void AudioOperation::onCompleted(Callback callback)
+{
+    if (m_state == Running)
+        m_callbacks.append(std::move(callback));
+    else
+        callback(*this);
+}
+
+AudioOperationPtr AudioOperation::andThen(std::function<AudioOperationPtr()> next)
+{
+    AudioOperationPtr chained = create();
+
+    // Cancelling the chain before it gets to next() cancels this step
+    std::weak_ptr<AudioOperation> weakSelf = shared_from_this();
+    chained->setCancelHandler([weakSelf] {
+        if (AudioOperationPtr self = weakSelf.lock())
+            self->cancel();
+    });
+    // The steps keep the chain alive until it completes, callers may drop it
+    onCompleted([chained, next = std::move(next)](const AudioOperation& op) {
+        if (!chained->isRunning())
+            return;
+
+        if (op.state() == Cancelled) {
+            chained->cancel();
+        } else if (op.state() == Failed) {
+            chained->fail(op.errorString());
+        } else {
+            AudioOperationPtr nextOp = next();
+            std::weak_ptr<AudioOperation> weakNext = nextOp;
+            chained->setCancelHandler([weakNext] {
+                if (AudioOperationPtr nextOp = weakNext.lock())
+                    nextOp->cancel();
+            });
+            nextOp->onCompleted([chained](const AudioOperation& op) {
+                chained->complete(op.state(), op.errorString());
+            });
+        }
+    });
+    return chained;
+}
+
+void AudioOperation::setCancelHandler(std::function<void()> handler)
+{
+    m_cancelHandler = std::move(handler);
+}
+
+void AudioOperation::finish()
+{
+    complete(Finished, QString());
+}
+
+void AudioOperation::fail(const QString& error)
+{
+    complete(Failed, error);
+}
+
+void AudioOperation::cancel()
+{
+    if (m_state != Running)
+        return;
+
+    std::function<void()> handler = std::move(m_cancelHandler);
+    complete(Cancelled, QString());
+    if (handler)
+        handler();
+}
+
+void AudioOperation::complete(State state, const QString& error)
+{
+    if (m_state != Running)
+        return;
+
+    // callbacks may drop the last reference to this operation
+    AudioOperationPtr self = shared_from_this();
+    m_state = state;
+    m_error = error;
+    m_cancelHandler = nullptr;
+
+    const QVector<Callback> callbacks = std::move(m_callbacks);
+    m_callbacks.clear();
+    for (const Callback& callback : callbacks)
+        callback(*this);
+}
@@ -0,0 +1,143 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+#include <functional>
+#include <memory>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <type_traits>
+#define AUDIO_OPERATION_COROUTINES 1
+#else
+#define AUDIO_OPERATION_COROUTINES 0
+#endif
+
+class AudioOperation;
+using AudioOperationPtr = std::shared_ptr<AudioOperation>;
+
+// Result of an asynchronous AudioEngine request.
+// Operations are created, completed and observed on the GUI thread only:
+// backends running their own thread must queue the completion back.
+class AudioOperation : public std::enable_shared_from_this<AudioOperation> {
+public:
+    enum State {
+        Running,
+        Finished,
+        Failed,
+        Cancelled
+    };
+    using Callback = std::function<void(const AudioOperation&)>;
+
+    static AudioOperationPtr create();
+    static AudioOperationPtr finished();
+    static AudioOperationPtr failed(const QString& error);
+
+    State state() const { return m_state; }
+    bool isRunning() const { return m_state == Running; }
+    bool isFinished() const { return m_state == Finished; }
+    const QString& errorString() const { return m_error; }
+
+    // Called once on completion, right away if already completed
+    void onCompleted(Callback callback);
+    // Starts the operation returned by next() once this one finished,
+    // failure and cancellation are forwarded without calling next().
+    // The returned operation lives until completed, even if dropped.
+    AudioOperationPtr andThen(std::function<AudioOperationPtr()> next);
+    // Runs handler if the operation gets cancelled while running
+    void setCancelHandler(std::function<void()> handler);
+
+    void finish();
+    void fail(const QString& error);
+    void cancel();
+
+private:
+    AudioOperation();
+    void complete(State state, const QString& error);
+
+    State m_state;
+    QString m_error;
+    QVector<Callback> m_callbacks;
+    std::function<void()> m_cancelHandler;
+};
+
+#if AUDIO_OPERATION_COROUTINES
+// Coroutines returning AudioOperationPtr can co_await other operations:
+// a failed or cancelled await completes the coroutine operation the same way
+// and the coroutine is not resumed.
+struct AudioOperationPromise {
+    // user provided, so the promise is never built from the coroutine
+    // arguments: an AudioOperationPtr argument would become the result
+    AudioOperationPromise()
+        : operation(AudioOperation::create())
+    {
+    }
+
+    AudioOperationPtr operation;
+
+    AudioOperationPtr get_return_object() { return operation; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() { operation->finish(); }
+    void unhandled_exception() { operation->fail(QStringLiteral("Unhandled exception")); }
+};
+
+template <typename... Args>
+struct std::coroutine_traits<AudioOperationPtr, Args...> {
+    using promise_type = AudioOperationPromise;
+};
+
+struct AudioOperationAwaiter {
+    AudioOperationPtr operation;
+
+    // failed and cancelled operations go through await_suspend() too,
+    // which completes the coroutine without resuming it
+    bool await_ready() const { return operation->isFinished(); }
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> handle)
+    {
+        if constexpr (std::is_same_v<Promise, AudioOperationPromise>) {
+            AudioOperationPtr awaited = operation;
+            handle.promise().operation->setCancelHandler([awaited] { awaited->cancel(); });
+        }
+        operation->onCompleted([handle](const AudioOperation& op) {
+            if constexpr (std::is_same_v<Promise, AudioOperationPromise>) {
+                if (!op.isFinished()) {
+                    AudioOperationPtr result = handle.promise().operation;
+                    handle.destroy();
+                    op.state() == AudioOperation::Cancelled ? result->cancel()
+                                                            : result->fail(op.errorString());
+                    return;
+                }
+            }
+            handle.resume();
+        });
+    }
+    const AudioOperation& await_resume() const { return *operation; }
+};
+
+inline AudioOperationAwaiter operator co_await(AudioOperationPtr operation)
+{
+    return AudioOperationAwaiter { std::move(operation) };
+}
+#endif
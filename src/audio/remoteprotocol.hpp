@@ -0,0 +1,141 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstring>
+
+// Shared memory protocol between RemoteEngine and the engine helper process.
+// Both rings are single producer, single consumer: the tray only pushes
+// commands and pops events, the helper the other way around. A push is
+// followed by an eventfd write so the other side wakes up, it then drains
+// the ring completely.
+namespace AudioRemote {
+
+constexpr quint32 Magic = 0x564f4c52; // "VOLR"
+constexpr quint32 Version = 2;
+
+template <typename T, quint32 Size>
+class SpscRing {
+    static_assert((Size & (Size - 1)) == 0, "Size must be a power of two");
+    static_assert(std::atomic<quint32>::is_always_lock_free, "the ring is shared between processes");
+
+public:
+    void reset()
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+    bool push(const T& item)
+    {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == Size)
+            return false;
+
+        m_items[head & (Size - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T* item)
+    {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+
+        *item = m_items[tail & (Size - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // producer and consumer indexes on their own cache lines
+    alignas(64) std::atomic<quint32> m_head;
+    alignas(64) std::atomic<quint32> m_tail;
+    alignas(64) T m_items[Size];
+};
+
+struct Command {
+    enum Type : quint32 {
+        SetVolume,
+        SetMute,
+        SetNormalized,
+        Quit,
+        UseDevice,
+        SetIgnoreMaxVolume,
+        OpenFeedback,
+        CloseFeedback,
+        PlayFeedback
+    };
+    Type type;
+    quint32 device;
+    qint32 value;
+    quint64 serial; // echoed back by the Done event
+};
+
+// Device state is sent whole, the helper merges every change of a device
+// made since its last flush into a single Update.
+struct Event {
+    enum Type : quint32 {
+        Update,
+        Remove,
+        ListDone, // every device was reported after (re)start
+        Done,
+        Recording // volume holds the stream count
+    };
+    Type type;
+    quint32 device;
+    qint32 volume;
+    qint32 state;
+    quint8 mute;
+    quint8 failed;
+    quint8 bound;
+    quint64 serial;
+    char key[96];
+    char name[64];
+    char description[128];
+};
+
+struct SharedBlock {
+    quint32 magic;
+    quint32 version;
+    SpscRing<Command, 256> commands;
+    SpscRing<Event, 512> events;
+
+    void reset()
+    {
+        magic = Magic;
+        version = Version;
+        commands.reset();
+        events.reset();
+    }
+    bool isValid() const { return magic == Magic && version == Version; }
+};
+
+// Truncated to the field size, always terminated
+template <size_t N>
+inline void copyString(char (&field)[N], const QByteArray& value)
+{
+    const size_t size = qMin(static_cast<size_t>(value.size()), N - 1);
+    std::memcpy(field, value.constData(), size);
+    field[size] = '\0';
+}
+} // namespace AudioRemote
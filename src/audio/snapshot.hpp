@@ -0,0 +1,50 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include "audio/device.hpp"
+
+#include <QString>
+#include <QVector>
+
+#include <memory>
+
+struct AudioDeviceSnapshot {
+    QString key;
+    QString name;
+    QString description;
+    uint index = 0;
+    int volume = 0;
+    bool mute = false;
+    bool bound = true; // volume and mute are unknown otherwise
+    AudioDevice::State state = AudioDevice::Unknown;
+    quint64 latency = 0; // usecs, last health sample
+    quint32 xruns = 0; // last health sample
+};
+
+// Immutable copy of an engine device list. A new one is published after
+// each dispatcher batch that changed something, a snapshot once obtained
+// never changes and may be read from any thread.
+struct AudioSnapshot {
+    quint64 generation = 0; // grows with every publication
+    int engineId = -1;
+    QVector<AudioDeviceSnapshot> sinks;
+};
+using AudioSnapshotPtr = std::shared_ptr<const AudioSnapshot>;
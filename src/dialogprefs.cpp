@@ -45,6 +45,7 @@ void Qtilities::DialogPrefs::loadSettings()
     ui->cbxChannel->setCurrentIndex(settings.channelId());
     ui->chkNormalize->setChecked(settings.isNormalized());
     ui->chkMuteOnMiddleClick->setChecked(settings.muteOnMiddleClick());
+    ui->chkVolumeFeedback->setChecked(settings.volumeFeedback());
     ui->sbxPageStep->setValue(settings.pageStep());
     ui->sbxStep->setValue(settings.singleStep());
     ui->txtMixerCmd->setText(settings.mixerCommand());
@@ -61,6 +62,7 @@ void Qtilities::DialogPrefs::accept()
     settings.setChannelId(ui->cbxChannel->currentIndex());
     settings.setNormalized(ui->chkNormalize->isChecked());
     settings.setMuteOnMiddleClick(ui->chkMuteOnMiddleClick->isChecked());
+    settings.setVolumeFeedback(ui->chkVolumeFeedback->isChecked());
     settings.setPageStep(ui->sbxPageStep->value());
     settings.setSingleStep(ui->sbxStep->value());
     settings.setMixerCommand(ui->txtMixerCmd->text());
@@ -0,0 +1,154 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "globalkeys.hpp"
+
+#include <QSocketNotifier>
+#include <QDebug>
+
+#include <xcb/xcb.h>
+
+#include <cstdlib>
+
+// XF86XK_AudioRaiseVolume, XF86XK_AudioLowerVolume, XF86XK_AudioMute
+static const xcb_keysym_t keySyms[] = { 0x1008FF13, 0x1008FF11, 0x1008FF12 };
+
+Qtilities::GlobalKeys::GlobalKeys(QObject *parent)
+    : QObject(parent)
+    , connection_(nullptr)
+    , notifier_(nullptr)
+    , root_(XCB_WINDOW_NONE)
+    , lastRelease_()
+{
+    int screenNumber = 0;
+    connection_ = xcb_connect(nullptr, &screenNumber);
+    if (xcb_connection_has_error(connection_)) {
+        qWarning() << "GlobalKeys: cannot connect to the X server";
+        return;
+    }
+    xcb_screen_iterator_t it = xcb_setup_roots_iterator(xcb_get_setup(connection_));
+    for (; it.rem && screenNumber > 0; --screenNumber)
+        xcb_screen_next(&it);
+
+    if (!it.rem)
+        return;
+
+    root_ = it.data->root;
+    grabKeys();
+
+    bool grabbed = false;
+    for (const QVector<quint8> &keycodes : keycodes_)
+        grabbed = grabbed || !keycodes.isEmpty();
+
+    if (!grabbed)
+        return;
+
+    notifier_ = new QSocketNotifier(xcb_get_file_descriptor(connection_), QSocketNotifier::Read, this);
+    connect(notifier_, &QSocketNotifier::activated, this, &GlobalKeys::readEvents);
+}
+
+Qtilities::GlobalKeys::~GlobalKeys()
+{
+    // releases the grabs as well
+    xcb_disconnect(connection_);
+}
+
+void Qtilities::GlobalKeys::grabKeys()
+{
+    for (QVector<quint8> &keycodes : keycodes_)
+        keycodes.clear();
+
+    const xcb_setup_t *setup = xcb_get_setup(connection_);
+    const xcb_keycode_t minKeycode = setup->min_keycode;
+    const xcb_keycode_t maxKeycode = setup->max_keycode;
+
+    xcb_get_keyboard_mapping_cookie_t cookie
+        = xcb_get_keyboard_mapping(connection_, minKeycode, maxKeycode - minKeycode + 1);
+    xcb_get_keyboard_mapping_reply_t *reply = xcb_get_keyboard_mapping_reply(connection_, cookie, nullptr);
+    if (!reply)
+        return;
+
+    const xcb_keysym_t *syms = xcb_get_keyboard_mapping_keysyms(reply);
+    const int count = xcb_get_keyboard_mapping_keysyms_length(reply);
+    const int perKeycode = reply->keysyms_per_keycode;
+
+    QVector<quint8> found[KeyMax];
+    for (int i = 0; perKeycode > 0 && i < count; ++i) {
+        for (int key = 0; key < KeyMax; ++key) {
+            const quint8 keycode = minKeycode + i / perKeycode;
+            if (syms[i] == keySyms[key] && !found[key].contains(keycode))
+                found[key].append(keycode);
+        }
+    }
+    std::free(reply);
+
+    // Any modifier combination, the keys are meant to work everywhere
+    for (int key = 0; key < KeyMax; ++key) {
+        for (quint8 keycode : qAsConst(found[key])) {
+            xcb_void_cookie_t grab = xcb_grab_key_checked(connection_, 1, root_, XCB_MOD_MASK_ANY, keycode,
+                                                          XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+            if (xcb_generic_error_t *error = xcb_request_check(connection_, grab)) {
+                qWarning() << "GlobalKeys: keycode" << keycode << "is grabbed by another client";
+                std::free(error);
+                continue;
+            }
+            keycodes_[key].append(keycode);
+        }
+    }
+}
+
+int Qtilities::GlobalKeys::keyOf(quint8 keycode) const
+{
+    for (int key = 0; key < KeyMax; ++key) {
+        if (keycodes_[key].contains(keycode))
+            return key;
+    }
+    return KeyMax;
+}
+
+// Every autorepeated press is reported, the tray item folds them into
+// at most one backend commit in flight.
+void Qtilities::GlobalKeys::readEvents()
+{
+    while (xcb_generic_event_t *event = xcb_poll_for_event(connection_)) {
+        const quint8 type = event->response_type & ~0x80;
+        if (type == XCB_KEY_PRESS || type == XCB_KEY_RELEASE) {
+            const xcb_key_press_event_t *keyEvent = reinterpret_cast<xcb_key_press_event_t *>(event);
+            const int key = keyOf(keyEvent->detail);
+
+            if (key < KeyMax) {
+                // autorepeat sends release and press with the same timestamp
+                if (type == XCB_KEY_RELEASE)
+                    lastRelease_[key] = keyEvent->time;
+                else if (key != Mute)
+                    emit sigVolumeStep(key == RaiseVolume ? 1 : -1);
+                else if (keyEvent->time != lastRelease_[key])
+                    emit sigMuteToggled();
+            }
+        } else if (type == XCB_MAPPING_NOTIFY) {
+            xcb_ungrab_key(connection_, XCB_GRAB_ANY, root_, XCB_MOD_MASK_ANY);
+            grabKeys();
+        }
+        std::free(event);
+    }
+    if (xcb_connection_has_error(connection_)) {
+        qWarning() << "GlobalKeys: lost the X server connection";
+        notifier_->setEnabled(false);
+    }
+}
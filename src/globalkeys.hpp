@@ -0,0 +1,67 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+struct xcb_connection_t;
+
+QT_BEGIN_NAMESPACE
+class QSocketNotifier;
+QT_END_NAMESPACE
+
+namespace Qtilities {
+
+// Grabs the XF86Audio media keys on the X11 root window through a private
+// connection, so it doesn't depend on the Qt platform plugin in use.
+class GlobalKeys : public QObject
+{
+    Q_OBJECT
+
+public:
+    GlobalKeys(QObject *parent = nullptr);
+    ~GlobalKeys();
+
+    // False when no key could be grabbed, e.g. the desktop already owns them
+    bool isActive() const { return notifier_ != nullptr; }
+
+signals:
+    void sigVolumeStep(int steps);
+    void sigMuteToggled();
+
+private:
+    enum Key {
+        RaiseVolume,
+        LowerVolume,
+        Mute,
+        KeyMax
+    };
+    void grabKeys();
+    void readEvents();
+    int keyOf(quint8 keycode) const;
+
+    xcb_connection_t *connection_;
+    QSocketNotifier *notifier_;
+    quint32 root_;
+    QVector<quint8> keycodes_[KeyMax]; // a keysym may sit on several keycodes
+    quint32 lastRelease_[KeyMax];
+};
+} // namespace Qtilities
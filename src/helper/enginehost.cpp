@@ -0,0 +1,255 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "helper/enginehost.hpp"
+#include "audio/device.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/engine.hpp"
+#if USE_ALSA
+#include "audio/device/alsa.hpp"
+#include "audio/engine/alsa.hpp"
+#endif
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+
+#include <unistd.h>
+
+using AudioRemote::Command;
+using AudioRemote::Event;
+
+EngineHost::EngineHost(AudioEngine* engine, AudioRemote::SharedBlock* block,
+                       int commandFd, int eventFd, QObject* parent)
+    : QObject(parent)
+    , m_engine(engine)
+    , m_block(block)
+    , m_commandFd(commandFd)
+    , m_eventFd(eventFd)
+    , m_commandNotifier(new QSocketNotifier(commandFd, QSocketNotifier::Read, this))
+    , m_nextId(0)
+{
+    m_retryTimer.setSingleShot(true);
+    m_retryTimer.setInterval(5);
+    connect(&m_retryTimer, &QTimer::timeout, this, &EngineHost::flush);
+
+    connect(m_commandNotifier, &QSocketNotifier::activated, this, &EngineHost::onCommandsReady);
+    connect(m_engine, &AudioEngine::sinkListChanged, this, &EngineHost::syncDevices);
+    connect(m_engine, &AudioEngine::recordingStreamsChanged, this, [this](int count) {
+        Event event {};
+        event.type = Event::Recording;
+        event.volume = count;
+        queueEvent(event);
+    });
+
+    // Engines discovering devices asynchronously emit sinkListChanged later
+    if (!m_engine->sinks().isEmpty())
+        syncDevices();
+
+    // Commands may have been queued before the helper was started
+    onCommandsReady();
+}
+
+void EngineHost::onCommandsReady()
+{
+    quint64 count;
+    while (read(m_commandFd, &count, sizeof(count)) > 0) { }
+
+    Command command;
+    while (m_block->commands.pop(&command))
+        apply(command);
+}
+
+void EngineHost::apply(const Command& command)
+{
+    if (command.type == Command::Quit) {
+        QCoreApplication::quit();
+        return;
+    }
+    if (command.type == Command::SetNormalized) {
+        m_engine->setNormalized(command.value);
+#if USE_ALSA
+        // Re-read the volumes with the new curve
+        if (AlsaEngine* alsa = qobject_cast<AlsaEngine*>(m_engine)) {
+            for (AudioDevice* dev : alsa->sinks())
+                alsa->updateDevice(static_cast<AlsaDevice*>(dev));
+        }
+#endif
+        return;
+    }
+    if (command.type == Command::SetIgnoreMaxVolume) {
+        m_engine->setIgnoreMaxVolume(command.value);
+        return;
+    }
+    // The click is played by the helper, next to the stream it goes to
+    if (command.type == Command::OpenFeedback || command.type == Command::PlayFeedback) {
+        if (AudioDevice* dev = m_devices.value(command.device)) {
+            if (command.type == Command::OpenFeedback)
+                m_engine->openFeedback(dev);
+            else
+                m_engine->playFeedback(dev);
+        }
+        return;
+    }
+    if (command.type == Command::CloseFeedback) {
+        m_engine->closeFeedback();
+        return;
+    }
+    if (command.type == Command::UseDevice) {
+        if (AudioDevice* dev = m_devices.value(command.device))
+            m_engine->useDevice(dev);
+        return;
+    }
+    const quint64 serial = command.serial;
+    auto done = [this, serial](bool failed) {
+        Event event {};
+        event.type = Event::Done;
+        event.serial = serial;
+        event.failed = failed;
+        queueEvent(event);
+    };
+    AudioDevice* dev = m_devices.value(command.device);
+    if (!dev) {
+        done(true);
+        return;
+    }
+    AudioOperationPtr operation;
+    if (command.type == Command::SetVolume) {
+        dev->setVolumeNoCommit(command.value);
+        operation = m_engine->commitDeviceVolumeAsync(dev);
+    } else if (command.type == Command::SetMute) {
+        dev->setMuteNoCommit(command.value);
+        operation = m_engine->setMuteAsync(dev, command.value);
+    } else {
+        done(true);
+        return;
+    }
+    operation->onCompleted([done](const AudioOperation& op) {
+        done(!op.isFinished());
+    });
+}
+
+void EngineHost::syncDevices()
+{
+    const QList<AudioDevice*>& sinks = m_engine->sinks();
+    for (auto it = m_devices.begin(); it != m_devices.end();) {
+        // a deleted device may have left its address to a new one
+        if (it.value() && sinks.contains(it.value())) {
+            ++it;
+            continue;
+        }
+        Event event {};
+        event.type = Event::Remove;
+        event.device = it.key();
+        queueEvent(event);
+        m_dirty.remove(it.key());
+        it = m_devices.erase(it);
+    }
+    for (AudioDevice* dev : sinks) {
+        if (idOf(dev))
+            continue;
+
+        const quint32 id = ++m_nextId;
+        m_devices.insert(id, dev);
+        auto dirty = [this, id]() { markDirty(id); };
+        connect(dev, &AudioDevice::volumeChanged, this, dirty);
+        connect(dev, &AudioDevice::muteChanged, this, dirty);
+        connect(dev, &AudioDevice::nameChanged, this, dirty);
+        connect(dev, &AudioDevice::descriptionChanged, this, dirty);
+        connect(dev, &AudioDevice::stateChanged, this, dirty);
+        connect(dev, &AudioDevice::boundChanged, this, dirty);
+        markDirty(id);
+    }
+    Event event {};
+    event.type = Event::ListDone;
+    queueEvent(event);
+}
+
+// Ids start at 1, 0 is no device
+quint32 EngineHost::idOf(AudioDevice* device) const
+{
+    for (auto it = m_devices.cbegin(); it != m_devices.cend(); ++it) {
+        if (it.value() == device)
+            return it.key();
+    }
+    return 0;
+}
+
+void EngineHost::markDirty(quint32 id)
+{
+    if (!m_devices.value(id))
+        return;
+
+    m_dirty.insert(id);
+    scheduleFlush();
+}
+
+void EngineHost::queueEvent(const Event& event)
+{
+    m_backlog.push_back(event);
+    scheduleFlush();
+}
+
+void EngineHost::scheduleFlush()
+{
+    AudioDispatcher::instance()->post(AudioDispatcher::View, this, 0, [this]() {
+        flush();
+    });
+}
+
+void EngineHost::flush()
+{
+    bool pushed = false;
+    for (auto it = m_dirty.begin(); it != m_dirty.end();) {
+        AudioDevice* dev = m_devices.value(*it);
+        if (!dev) {
+            // its removal is reported by the next sync
+            it = m_dirty.erase(it);
+            continue;
+        }
+        Event event {};
+        event.type = Event::Update;
+        event.device = *it;
+        event.volume = dev->volume();
+        event.mute = dev->mute();
+        event.state = dev->state();
+        event.bound = dev->isBound();
+        AudioRemote::copyString(event.key, dev->key().toUtf8());
+        AudioRemote::copyString(event.name, dev->name().toUtf8());
+        AudioRemote::copyString(event.description, dev->description().toUtf8());
+        if (!m_block->events.push(event))
+            break;
+
+        pushed = true;
+        it = m_dirty.erase(it);
+    }
+    while (m_dirty.isEmpty() && !m_backlog.empty()) {
+        if (!m_block->events.push(m_backlog.front()))
+            break;
+
+        pushed = true;
+        m_backlog.pop_front();
+    }
+    if (pushed) {
+        const quint64 one = 1;
+        if (write(m_eventFd, &one, sizeof(one)) < 0)
+            qWarning("EngineHost: cannot wake the tray");
+    }
+    if (!m_dirty.isEmpty() || !m_backlog.empty())
+        m_retryTimer.start();
+}
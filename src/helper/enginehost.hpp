@@ -0,0 +1,69 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include "audio/remoteprotocol.hpp"
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QTimer>
+
+#include <deque>
+
+class AudioDevice;
+class AudioEngine;
+class QSocketNotifier;
+
+// Serves an engine to RemoteEngine over the shared block: applies the
+// commands and reports device changes, merged per device so a burst of
+// changes in one event loop turn costs a single ring slot and wakeup.
+class EngineHost : public QObject {
+    Q_OBJECT
+
+public:
+    EngineHost(AudioEngine* engine, AudioRemote::SharedBlock* block,
+               int commandFd, int eventFd, QObject* parent = nullptr);
+
+private:
+    void onCommandsReady();
+    void apply(const AudioRemote::Command& command);
+    void syncDevices();
+    quint32 idOf(AudioDevice* device) const;
+    void markDirty(quint32 id);
+    void queueEvent(const AudioRemote::Event& event);
+    void scheduleFlush();
+    void flush();
+
+    AudioEngine* m_engine;
+    AudioRemote::SharedBlock* m_block;
+    int m_commandFd;
+    int m_eventFd;
+    QSocketNotifier* m_commandNotifier;
+    // the tray is not draining the events ring fast enough
+    QTimer m_retryTimer;
+    quint32 m_nextId;
+    // Keyed by id, a device address may be reused once the device is deleted
+    QHash<quint32, QPointer<AudioDevice>> m_devices;
+    QSet<quint32> m_dirty;
+    // sent in order once every dirty device was reported
+    std::deque<AudioRemote::Event> m_backlog;
+};
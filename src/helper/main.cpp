@@ -0,0 +1,86 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "helper/enginehost.hpp"
+#include "audio/engine.hpp"
+#include "audio/engineid.hpp"
+#if USE_ALSA
+#include "audio/engine/alsa.hpp"
+#endif
+#if USE_PULSEAUDIO
+#include "audio/engine/pulseaudio.hpp"
+#endif
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QtDebug>
+
+#include <csignal>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+// Engine helper, started by RemoteEngine with the shared block and
+// eventfd descriptors it inherits: <engine id> <shm fd> <command fd> <event fd>
+int main(int argc, char* argv[])
+{
+    // Go away with the tray whatever the way it ends
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    int values[4];
+    bool valid = args.count() == 5;
+    for (int i = 0; valid && i < 4; ++i)
+        values[i] = args.at(i + 1).toInt(&valid);
+
+    if (!valid) {
+        qCritical("Usage: %s <engine id> <shm fd> <command fd> <event fd>", argv[0]);
+        return 1;
+    }
+    void* memory = mmap(nullptr, sizeof(AudioRemote::SharedBlock), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, values[1], 0);
+    if (memory == MAP_FAILED) {
+        qCritical("Cannot map the shared block");
+        return 1;
+    }
+    auto* block = static_cast<AudioRemote::SharedBlock*>(memory);
+    if (!block->isValid()) {
+        qCritical("Shared block version mismatch");
+        return 1;
+    }
+    AudioEngine* engine = nullptr;
+    switch (values[0]) {
+#if USE_ALSA
+    case EngineId::Alsa:
+        engine = new AlsaEngine(&app);
+        break;
+#endif
+#if USE_PULSEAUDIO
+    case EngineId::PulseAudio:
+        engine = new PulseAudioEngine(&app);
+        break;
+#endif
+    default:
+        qCritical("Unsupported engine %d", values[0]);
+        return 1;
+    }
+    EngineHost host(engine, block, values[2], values[3]);
+    return app.exec();
+}
@@ -0,0 +1,244 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "hooks.hpp"
+#include "application.hpp"
+
+#include "audio/device.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/engine.hpp"
+
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJSEngine>
+#include <QMutex>
+#include <QStandardPaths>
+#include <QThread>
+#include <QWaitCondition>
+#include <QDebug>
+
+namespace Qtilities {
+
+// Interrupts the JS engine from its own thread once an armed deadline expires,
+// the GUI thread is busy running the script meanwhile.
+class HookWatchdog
+{
+public:
+    HookWatchdog(QJSEngine *engine)
+        : engine_(engine)
+        , armed_(false)
+        , quit_(false)
+        , thread_(QThread::create([this] { run(); }))
+    {
+        thread_->start();
+    }
+    ~HookWatchdog()
+    {
+        mutex_.lock();
+        quit_ = true;
+        condition_.wakeOne();
+        mutex_.unlock();
+        thread_->wait();
+        delete thread_;
+    }
+    void arm(int msec)
+    {
+        QMutexLocker locker(&mutex_);
+        deadline_ = QDeadlineTimer(msec);
+        armed_ = true;
+        condition_.wakeOne();
+    }
+    void disarm()
+    {
+        QMutexLocker locker(&mutex_);
+        armed_ = false;
+        condition_.wakeOne();
+    }
+
+private:
+    void run()
+    {
+        QMutexLocker locker(&mutex_);
+        while (!quit_) {
+            if (!armed_) {
+                condition_.wait(&mutex_);
+            } else if (!condition_.wait(&mutex_, deadline_) && armed_ && deadline_.hasExpired()) {
+                engine_->setInterrupted(true);
+                armed_ = false;
+            }
+        }
+    }
+
+    QJSEngine *engine_;
+    QMutex mutex_;
+    QWaitCondition condition_;
+    QDeadlineTimer deadline_;
+    bool armed_;
+    bool quit_;
+    QThread *thread_;
+};
+} // namespace Qtilities
+
+Qtilities::Hooks::Hooks(QObject *parent)
+    : QObject(parent)
+    , jsEngine_(new QJSEngine(this))
+    , watchdog_(new HookWatchdog(jsEngine_))
+    , budget_(static_cast<Application *>(qApp)->settings().hookBudget())
+{
+    jsEngine_->installExtensions(QJSEngine::ConsoleExtension);
+    load();
+}
+
+Qtilities::Hooks::~Hooks() { delete watchdog_; }
+
+void Qtilities::Hooks::load()
+{
+    const QString path = QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation)
+                         + QStringLiteral("/hooks");
+    const QStringList files = QDir(path).entryList({QStringLiteral("*.js")}, QDir::Files, QDir::Name);
+
+    for (const QString &fileName : files) {
+        QFile file(QDir(path).filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qWarning() << "Hooks: cannot read" << file.fileName();
+            continue;
+        }
+        // Every script gets its own scope, the handlers it defines are collected once
+        const QString program = QStringLiteral("(function() {") + QString::fromUtf8(file.readAll())
+                                + QStringLiteral("\nreturn {"
+                                                 "onVolumeChanged: typeof onVolumeChanged === 'function' ? onVolumeChanged : null,"
+                                                 "onMuteChanged: typeof onMuteChanged === 'function' ? onMuteChanged : null,"
+                                                 "onDeviceAdded: typeof onDeviceAdded === 'function' ? onDeviceAdded : null,"
+                                                 "onDeviceRemoved: typeof onDeviceRemoved === 'function' ? onDeviceRemoved : null"
+                                                 "}; })()");
+        Script script {fileName, QJSValue(), true};
+        const QString source = file.fileName();
+        if (run(script, QStringLiteral("load"), [&] { return jsEngine_->evaluate(program, source); },
+                &script.handlers))
+            scripts_.append(script);
+    }
+}
+
+// False when the call failed or overran the budget
+bool Qtilities::Hooks::run(Script &script, const QString &name, const std::function<QJSValue()> &function,
+                          QJSValue *result)
+{
+    QElapsedTimer timer;
+    timer.start();
+    watchdog_->arm(budget_);
+    QJSValue value = function();
+    watchdog_->disarm();
+
+    if (jsEngine_->isInterrupted() || timer.elapsed() > budget_) {
+        jsEngine_->setInterrupted(false);
+        script.enabled = false;
+        qWarning() << "Hooks:" << script.fileName << "exceeded" << budget_ << "ms in" << name << "and got disabled";
+        return false;
+    }
+    if (value.isError()) {
+        qWarning() << "Hooks:" << script.fileName << "line" << value.property(QStringLiteral("lineNumber")).toInt()
+                   << value.toString();
+        return false;
+    }
+    if (result)
+        *result = value;
+
+    return true;
+}
+
+void Qtilities::Hooks::call(const QString &name, const QJSValueList &args)
+{
+    for (Script &script : scripts_) {
+        if (!script.enabled)
+            continue;
+
+        QJSValue function = script.handlers.property(name);
+        if (!function.isCallable())
+            continue;
+
+        run(script, name, [&] { return function.call(args); });
+    }
+}
+
+void Qtilities::Hooks::setEngine(AudioEngine *engine)
+{
+    if (engine_)
+        disconnect(engine_, nullptr, this, nullptr);
+
+    engine_ = engine;
+    if (engine_)
+        connect(engine_, &AudioEngine::sinkListChanged, this, &Hooks::onSinkListChanged);
+
+    onSinkListChanged();
+}
+
+// Engines only report the list changed, additions and removals come from a diff by key
+void Qtilities::Hooks::onSinkListChanged()
+{
+    QMap<QString, QPointer<AudioDevice>> current;
+    if (engine_) {
+        for (AudioDevice *device : engine_->sinks())
+            current.insert(device->key(), device);
+    }
+    for (auto it = devices_.cbegin(); it != devices_.cend(); ++it) {
+        if (!current.contains(it.key()))
+            call(QStringLiteral("onDeviceRemoved"), {deviceValues_.take(it.key())});
+    }
+    for (auto it = current.cbegin(); it != current.cend(); ++it) {
+        if (devices_.value(it.key()) == it.value())
+            continue;
+
+        watch(it.value());
+        const bool added = !devices_.contains(it.key());
+        deviceValues_.insert(it.key(), deviceValue(it.value()));
+        if (added)
+            call(QStringLiteral("onDeviceAdded"), {deviceValues_.value(it.key())});
+    }
+    devices_ = current;
+}
+
+// Bursts of changes reach the scripts once per dispatcher turn with the latest value
+void Qtilities::Hooks::watch(AudioDevice *device)
+{
+    QPointer<Hooks> self(this);
+    QPointer<AudioDevice> guard(device);
+    connect(device, &AudioDevice::volumeChanged, this, [self, guard]() {
+        AudioDispatcher::instance()->post(AudioDispatcher::View, guard.data(), 0, [self, guard]() {
+            if (self && guard)
+                self->call(QStringLiteral("onVolumeChanged"), {self->deviceValue(guard), guard->volume()});
+        });
+    });
+    connect(device, &AudioDevice::muteChanged, this, [self, guard]() {
+        AudioDispatcher::instance()->post(AudioDispatcher::View, guard.data(), 1, [self, guard]() {
+            if (self && guard)
+                self->call(QStringLiteral("onMuteChanged"), {self->deviceValue(guard), guard->mute()});
+        });
+    });
+}
+
+QJSValue Qtilities::Hooks::deviceValue(AudioDevice *device)
+{
+    QJSValue value = jsEngine_->newObject();
+    value.setProperty(QStringLiteral("key"), device->key());
+    value.setProperty(QStringLiteral("name"), device->name());
+    value.setProperty(QStringLiteral("description"), device->description());
+    return value;
+}
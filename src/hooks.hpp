@@ -0,0 +1,79 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QJSValue>
+#include <QMap>
+#include <QObject>
+#include <QPointer>
+#include <QVector>
+
+#include <functional>
+
+class AudioDevice;
+class AudioEngine;
+
+QT_BEGIN_NAMESPACE
+class QJSEngine;
+QT_END_NAMESPACE
+
+namespace Qtilities {
+
+class HookWatchdog;
+
+// Runs the *.js files of the "hooks" config directory in-process.
+// Each file is compiled once and may define any of:
+//   onVolumeChanged(device, volume), onMuteChanged(device, muted),
+//   onDeviceAdded(device), onDeviceRemoved(device)
+// where device is {key, name, description}. A call running longer than
+// Settings::hookBudget() is interrupted and its script disabled.
+class Hooks : public QObject
+{
+    Q_OBJECT
+
+public:
+    Hooks(QObject *parent = nullptr);
+    ~Hooks();
+
+    void setEngine(AudioEngine *);
+
+private:
+    struct Script {
+        QString fileName;
+        QJSValue handlers;
+        bool enabled;
+    };
+    void load();
+    void call(const QString &name, const QJSValueList &args);
+    bool run(Script &, const QString &name, const std::function<QJSValue()> &, QJSValue *result = nullptr);
+    void onSinkListChanged();
+    void watch(AudioDevice *);
+    QJSValue deviceValue(AudioDevice *);
+
+    QJSEngine *jsEngine_;
+    HookWatchdog *watchdog_;
+    QVector<Script> scripts_;
+    QPointer<AudioEngine> engine_;
+    // Known devices by key, removed ones are reported with their last value
+    QMap<QString, QPointer<AudioDevice>> devices_;
+    QMap<QString, QJSValue> deviceValues_;
+    int budget_;
+};
+} // namespace Qtilities
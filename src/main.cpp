@@ -0,0 +1,30 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "application.hpp"
+
+int main(int argc, char* argv[])
+{
+    // UseHighDpiPixmaps is default from Qt6
+#if QT_VERSION < 0x060000
+    QGuiApplication::setAttribute(Qt::AA_UseHighDpiPixmaps, true);
+#endif
+    Qtilities::Application app(argc, argv);
+    return app.exec();
+}
@@ -23,11 +23,14 @@
 #include "settings.hpp"
 
 #include <QAction>
+#include <QActionGroup>
 #include <QApplication>
 #include <QCheckBox>
 #include <QFrame>
+#include <QGridLayout>
 #include <QLabel>
 #include <QMenu>
+#include <QProgressBar>
 #include <QScreen>
 #include <QSlider>
 #include <QToolButton>
@@ -38,8 +41,13 @@
 Qtilities::MenuVolume::MenuVolume(QWidget* parent)
     : QMenu(parent)
     , chkMute_(new QCheckBox(tr("Mute"), this))
+    , lblStatus_(new QLabel(this))
     , lblVolume_(new QLabel("0", this))
     , sldVolume_(new QSlider(Qt::Vertical, this))
+    , wgtStreams_(new QWidget(this))
+    , lytStreams_(new QGridLayout(wgtStreams_))
+    , mnuPorts_(new QMenu(tr("Port"), this))
+    , mnuProfiles_(new QMenu(tr("Profile"), this))
 {
     QWidget* container = new QWidget(this);
     QWidgetAction* actContainer = new QWidgetAction(this);
@@ -55,6 +63,9 @@ Qtilities::MenuVolume::MenuVolume(QWidget* parent)
 
     tbnMixer->setText(tr("Mixer"));
 
+    lblStatus_->setAlignment(Qt::AlignCenter);
+    lblStatus_->setEnabled(false);
+    lblStatus_->setVisible(false);
     lblVolume_->setAlignment(Qt::AlignCenter);
 
     sldVolume_->setRange(0, 100);
@@ -63,20 +74,33 @@ Qtilities::MenuVolume::MenuVolume(QWidget* parent)
     sldVolume_->setTickPosition(QSlider::TicksBothSides);
     sldVolume_->setTickInterval(10);
 
+    lytStreams_->setContentsMargins(0, 0, 0, 0);
+    wgtStreams_->setVisible(false);
+
     layout->setSizeConstraint(QLayout::SetNoConstraint);
     layout->addWidget(tbnMixer);
     layout->addWidget(separator1);
     layout->addWidget(chkMute_);
     layout->addWidget(separator2);
+    layout->addWidget(lblStatus_);
     layout->addWidget(lblVolume_);
     layout->addWidget(sldVolume_);
     layout->setAlignment(sldVolume_, Qt::AlignHCenter);
     layout->addSpacing(6);
+    layout->addWidget(wgtStreams_);
 
     container->setLayout(layout);
     actContainer->setDefaultWidget(container);
     addAction(actContainer);
+    addMenu(mnuProfiles_)->setVisible(false);
+    addMenu(mnuPorts_)->setVisible(false);
 
+    connect(mnuPorts_, &QMenu::triggered, this, [this](QAction *action) {
+        emit sigPortSelected(action->data().toString());
+    });
+    connect(mnuProfiles_, &QMenu::triggered, this, [this](QAction *action) {
+        emit sigProfileSelected(action->data().toString());
+    });
     connect(tbnMixer, &QToolButton::released, this, &MenuVolume::sigRunMixer);
     connect(chkMute_, &QCheckBox::clicked, this, &MenuVolume::sigMuteToggled);
     connect(sldVolume_, &QSlider::valueChanged, this, [=](int value) {
@@ -90,10 +114,6 @@ void Qtilities::MenuVolume::loadSettings()
     Settings &settings = static_cast<Application *>(qApp)->settings();
     sldVolume_->setPageStep(settings.pageStep());
     sldVolume_->setSingleStep(settings.singleStep());
-
-    int volume = settings.volume();
-    if(volume >= 0 && volume <= 100)
-        sldVolume_->setValue(volume);
 }
 
 void Qtilities::MenuVolume::popUp()
@@ -124,6 +144,70 @@ void Qtilities::MenuVolume::setMute(bool mute)
     chkMute_->blockSignals(false);
 }
 
+void Qtilities::MenuVolume::setStatus(const QString &status)
+{
+    if (lblStatus_->text() == status)
+        return;
+
+    lblStatus_->setText(status);
+    lblStatus_->setVisible(!status.isEmpty());
+}
+
+// Rows are reused, the list is refreshed at the meter rate while shown
+void Qtilities::MenuVolume::setStreams(const QList<Stream> &streams)
+{
+    const bool resized = streamRows_.count() != streams.count();
+    while (streamRows_.count() > streams.count()) {
+        const auto row = streamRows_.takeLast();
+        delete row.first;
+        delete row.second;
+    }
+    while (streamRows_.count() < streams.count()) {
+        QLabel *name = new QLabel(wgtStreams_);
+        QProgressBar *level = new QProgressBar(wgtStreams_);
+        level->setRange(0, 100);
+        level->setTextVisible(false);
+        level->setMaximumHeight(6);
+        lytStreams_->addWidget(name, streamRows_.count() * 2, 0);
+        lytStreams_->addWidget(level, streamRows_.count() * 2 + 1, 0);
+        streamRows_.append({name, level});
+    }
+    for (int i = 0; i < streams.count(); ++i) {
+        streamRows_.at(i).first->setText(streams.at(i).name);
+        streamRows_.at(i).second->setValue(streams.at(i).level);
+    }
+    wgtStreams_->setVisible(!streams.isEmpty());
+    if (resized && isVisible())
+        adjustSize();
+}
+
+void Qtilities::MenuVolume::setPorts(const QList<Choice> &ports, const QString &active)
+{
+    setChoices(mnuPorts_, ports, active);
+}
+
+void Qtilities::MenuVolume::setProfiles(const QList<Choice> &profiles, const QString &active)
+{
+    setChoices(mnuProfiles_, profiles, active);
+}
+
+// Submenus with a single choice or less are hidden, there's nothing to switch to
+void Qtilities::MenuVolume::setChoices(QMenu *menu, const QList<Choice> &choices, const QString &active)
+{
+    menu->clear();
+    qDeleteAll(menu->findChildren<QActionGroup *>(QString(), Qt::FindDirectChildrenOnly));
+    QActionGroup *group = new QActionGroup(menu);
+    for (const Choice &choice : choices) {
+        QAction *action = menu->addAction(choice.text);
+        action->setData(choice.name);
+        action->setCheckable(true);
+        action->setChecked(choice.name == active);
+        action->setEnabled(choice.enabled);
+        group->addAction(action);
+    }
+    menu->menuAction()->setVisible(choices.count() > 1);
+}
+
 void Qtilities::MenuVolume::setVolume(int volume)
 {
     sldVolume_->blockSignals(true);
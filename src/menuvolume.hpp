@@ -23,7 +23,9 @@
 
 QT_BEGIN_NAMESPACE
 class QCheckBox;
+class QGridLayout;
 class QLabel;
+class QProgressBar;
 class QSlider;
 QT_END_NAMESPACE
 
@@ -33,21 +35,47 @@ class MenuVolume : public QMenu {
     Q_OBJECT
 
 public:
+    // An entry of the profile or port submenus
+    struct Choice {
+        QString name;
+        QString text;
+        bool enabled;
+    };
+    // A playback stream of the stream list, level from 0 to 100
+    struct Stream {
+        QString name;
+        int level;
+    };
+
     MenuVolume(QWidget* parent = nullptr);
 
     void loadSettings();
     void popUp();
     void setMute(bool);
+    void setPorts(const QList<Choice> &, const QString &active);
+    void setProfiles(const QList<Choice> &, const QString &active);
+    void setStatus(const QString &);
+    void setStreams(const QList<Stream> &);
     void setVolume(int);
 
 signals:
     void sigRunMixer();
     void sigMuteToggled(bool);
+    void sigPortSelected(const QString &name);
+    void sigProfileSelected(const QString &name);
     void sigVolumeChanged(int);
 
 private:
+    void setChoices(QMenu *, const QList<Choice> &, const QString &active);
+
     QCheckBox *chkMute_;
+    QLabel *lblStatus_;
     QLabel *lblVolume_;
     QSlider *sldVolume_;
+    QWidget *wgtStreams_;
+    QGridLayout *lytStreams_;
+    QList<QPair<QLabel *, QProgressBar *>> streamRows_;
+    QMenu *mnuPorts_;
+    QMenu *mnuProfiles_;
 };
 } // namespace Qtilities
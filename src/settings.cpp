@@ -21,20 +21,35 @@
 #include "audio/engineid.hpp"
 
 #include <QApplication>
+#include <QDataStream>
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMetaType>
+#include <QSaveFile>
 #include <QSettings>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <algorithm>
 
 Qtilities::Settings::Settings()
     : engineId_(-1)
     , channelId_(-1)
+    , hookBudget_(Default::hookBudget)
     , pageStep_(Default::pageStep)
     , singleStep_(Default::singleStep)
     , isMuted_(Default::isMuted)
     , isNormalized_(Default::isNormalized)
     , muteOnMiddleClick_(Default::muteOnMiddleClick)
     , useAutostart_(Default::useAutostart)
+    , useEngineHelper_(Default::useEngineHelper)
+    , volumeFeedback_(Default::volumeFeedback)
     , volume_(Default::volume)
     , mixerCommand_()
+    , extraDevices_()
 #if 0
     , ignoreMaxVolume_(Default::ignoreMaxVolume)
     , showAlwaysNotifications_(Default::showAlwaysNotifications)
@@ -44,11 +59,130 @@ Qtilities::Settings::Settings()
 {
 }
 
+namespace {
+
+constexpr quint32 cacheMagic = 0x564f4c43; // "VOLC"
+constexpr qint32 cacheVersion = 2;
+
+struct Source {
+    QString path;
+    qint64 modified;
+    qint64 size;
+};
+
+QDataStream &operator<<(QDataStream &stream, const Source &source)
+{
+    return stream << source.path << source.modified << source.size;
+}
+
+QDataStream &operator>>(QDataStream &stream, Source &source)
+{
+    return stream >> source.path >> source.modified >> source.size;
+}
+
+bool operator==(const Source &a, const Source &b)
+{
+    return a.path == b.path && a.modified == b.modified && a.size == b.size;
+}
+
+QString baseName()
+{
+    return QApplication::organizationName() + QLatin1Char('/') + QApplication::applicationDisplayName();
+}
+
+QString userConfigPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation)
+           + QLatin1Char('/') + baseName() + QStringLiteral(".ini");
+}
+
+// System files and their drop-ins, lowest priority first
+QVector<Source> systemSources()
+{
+    const QString base = baseName();
+    const QString userDir = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation);
+    QStringList systemDirs = QStandardPaths::standardLocations(QStandardPaths::GenericConfigLocation);
+    systemDirs.removeAll(userDir);
+
+    QStringList paths;
+    for (auto it = systemDirs.crbegin(); it != systemDirs.crend(); ++it) {
+        paths.append(*it + QLatin1Char('/') + base + QStringLiteral(".ini"));
+
+        QDir dropIns(*it + QLatin1Char('/') + base + QStringLiteral(".d"));
+        const QStringList files = dropIns.entryList({QStringLiteral("*.ini")}, QDir::Files, QDir::Name);
+        for (const QString &file : files)
+            paths.append(dropIns.filePath(file));
+    }
+
+    QVector<Source> sources;
+    for (const QString &path : qAsConst(paths)) {
+        QFileInfo info(path);
+        // missing files are part of the signature too, creating one invalidates the cache
+        sources.append({path, info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1,
+                        info.exists() ? info.size() : -1});
+    }
+    return sources;
+}
+
+void mergeFile(const QString &path, QVariantMap *values)
+{
+    QSettings layer(path, QSettings::IniFormat);
+    const QStringList keys = layer.allKeys();
+    for (const QString &key : keys)
+        values->insert(key, layer.value(key));
+}
+
+QString cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/settings.cache");
+}
+
+// The merged system layers are parsed again only when one of their files
+// changed, otherwise they cost a single small file read whatever their count.
+// The user file changes with every save() and is never part of the cache.
+void loadSystemLayers(QVariantMap *systemValues)
+{
+    const QVector<Source> sources = systemSources();
+
+    QFile cache(cachePath());
+    if (cache.open(QIODevice::ReadOnly)) {
+        QDataStream stream(&cache);
+        stream.setVersion(QDataStream::Qt_5_12);
+        quint32 magic;
+        qint32 version;
+        QVector<Source> cached;
+        stream >> magic >> version;
+        if (magic == cacheMagic && version == cacheVersion) {
+            stream >> cached >> *systemValues;
+            if (stream.status() == QDataStream::Ok && cached == sources)
+                return;
+        }
+    }
+    systemValues->clear();
+    for (const Source &source : sources) {
+        if (source.modified >= 0)
+            mergeFile(source.path, systemValues);
+    }
+
+    QDir().mkpath(QFileInfo(cachePath()).path());
+    QSaveFile file(cachePath());
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << cacheMagic << cacheVersion << sources << *systemValues;
+    file.commit();
+}
+} // namespace
+
 void Qtilities::Settings::load()
 {
-    QSettings settings(QSettings::IniFormat, QSettings::UserScope,
-                       QApplication::organizationName(),
-                       QApplication::applicationDisplayName());
+    loadSystemLayers(&systemValues_);
+
+    QVariantMap settings = systemValues_;
+    if (QFileInfo::exists(userConfigPath()))
+        mergeFile(userConfigPath(), &settings);
 
     int engineId = settings.value(QStringLiteral("EngineId"), QString()).toInt();
     if (engineId < EngineId::EngineMax)
@@ -60,12 +194,16 @@ void Qtilities::Settings::load()
 
     useAutostart_ = settings.value(QStringLiteral("Autostart"), Default::useAutostart).toBool();
     channelId_ = settings.value(QStringLiteral("ChannelId"), -1).toInt();
+    useEngineHelper_ = settings.value(QStringLiteral("EngineHelper"), Default::useEngineHelper).toBool();
+    extraDevices_ = settings.value(QStringLiteral("ExtraDevices"), QStringList()).toStringList();
+    hookBudget_ = std::max(1, settings.value(QStringLiteral("HookBudget"), Default::hookBudget).toInt());
     isMuted_ = settings.value(QStringLiteral("IsMuted"), Default::isMuted).toBool();
     isNormalized_ = settings.value(QStringLiteral("IsNormalized"), Default::isNormalized).toBool();
     mixerCommand_ = settings.value(QStringLiteral("MixerCommand"), QString()).toString();
     muteOnMiddleClick_ = settings.value(QStringLiteral("MuteOnMiddleClick"), Default::muteOnMiddleClick).toBool();
     pageStep_ = settings.value(QStringLiteral("PageStep"), Default::pageStep).toDouble();
     singleStep_ = settings.value(QStringLiteral("SingleStep"), Default::singleStep).toDouble();
+    volumeFeedback_ = settings.value(QStringLiteral("VolumeFeedback"), Default::volumeFeedback).toBool();
 #if 0
     ignoreMaxVolume_ = settings.value(QStringLiteral("IgnoreMaxVolume"), Default::ignoreMaxVolume).toBool();
     showOnLeftClick_ = settings.value(QStringLiteral("ShowOnLeftClick"), Default::showOnLeftClick).toBool();
@@ -80,16 +218,37 @@ void Qtilities::Settings::save()
                        QApplication::organizationName(),
                        QApplication::applicationDisplayName());
 
-    settings.setValue(QStringLiteral("Autostart"), useAutostart_);
-    settings.setValue(QStringLiteral("ChannelId"), channelId_);
-    settings.setValue(QStringLiteral("EngineId"), engineId_);
-    settings.setValue(QStringLiteral("IsMuted"), isMuted_);
-    settings.setValue(QStringLiteral("IsNormalized"), isNormalized_);
-    settings.setValue(QStringLiteral("MixerCommand"), mixerCommand_);
-    settings.setValue(QStringLiteral("MuteOnMiddleClick"), muteOnMiddleClick_);
-    settings.setValue(QStringLiteral("PageStep"), pageStep_);
-    settings.setValue(QStringLiteral("SingleStep"), singleStep_);
-    settings.setValue(QStringLiteral("Volume"), volume_);
+    // Values matching the system layers stay out of the user file,
+    // so later changes to the site defaults still apply. INI values are
+    // read back as strings: compare them as the type being saved,
+    // e.g. "2" and 2.0 are the same step.
+    auto setValue = [&](const QString &key, const QVariant &value) {
+        QVariant system = systemValues_.value(key);
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        const bool converted = system.convert(value.metaType());
+#else
+        const bool converted = system.convert(value.userType());
+#endif
+        if (systemValues_.contains(key) && converted && system == value)
+            settings.remove(key);
+        else
+            settings.setValue(key, value);
+    };
+
+    setValue(QStringLiteral("Autostart"), useAutostart_);
+    setValue(QStringLiteral("ChannelId"), channelId_);
+    setValue(QStringLiteral("EngineHelper"), useEngineHelper_);
+    setValue(QStringLiteral("EngineId"), engineId_);
+    setValue(QStringLiteral("ExtraDevices"), extraDevices_);
+    setValue(QStringLiteral("HookBudget"), hookBudget_);
+    setValue(QStringLiteral("IsMuted"), isMuted_);
+    setValue(QStringLiteral("IsNormalized"), isNormalized_);
+    setValue(QStringLiteral("MixerCommand"), mixerCommand_);
+    setValue(QStringLiteral("MuteOnMiddleClick"), muteOnMiddleClick_);
+    setValue(QStringLiteral("PageStep"), pageStep_);
+    setValue(QStringLiteral("SingleStep"), singleStep_);
+    setValue(QStringLiteral("Volume"), volume_);
+    setValue(QStringLiteral("VolumeFeedback"), volumeFeedback_);
 #if 0
     settings.setValue(QStringLiteral("IgnoreMaxVolume"), ignoreMaxVolume_);
     settings.setValue(QStringLiteral("ShowAlwaysNotifications"), showAlwaysNotifications_);
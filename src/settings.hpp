@@ -20,6 +20,8 @@
 #pragma once
 
 #include <QString>
+#include <QStringList>
+#include <QVariantMap>
 
 namespace Qtilities {
 
@@ -28,9 +30,12 @@ namespace Default {
     static constexpr bool isNormalized = true;
     static constexpr bool muteOnMiddleClick = true;
     static constexpr bool useAutostart = false;
+    static constexpr bool useEngineHelper = false;
+    static constexpr bool volumeFeedback = false;
     static constexpr double pageStep = 2.00;
     static constexpr double singleStep = 1.00;
     static constexpr int volume = -1;
+    static constexpr int hookBudget = 50;
 #if 0
     const bool ignoreMaxVolume = false;
     const bool showAlwaysNotifications = false;
@@ -39,6 +44,10 @@ namespace Default {
 #endif
 } // namespace Default
 
+// Layered on top of each other, the last one wins:
+// $XDG_CONFIG_DIRS/<org>/<app>.ini, then the *.ini drop-ins of
+// $XDG_CONFIG_DIRS/<org>/<app>.d sorted by name, then the user file.
+// save() only writes to the user file what differs from the layers below.
 class Settings {
 public:
     Settings();
@@ -55,10 +64,10 @@ public:
     int volume() const { return volume_; }
     void setVolume(int volume) { volume_ = volume; }
 
-    double pageStep() { return pageStep_; }
+    double pageStep() const { return pageStep_; }
     void setPageStep(double step) { pageStep_ = step; }
 
-    double singleStep() { return singleStep_; }
+    double singleStep() const { return singleStep_; }
     void setSingleStep(double step) { singleStep_ = step; }
 
     bool isNormalized() const { return isNormalized_; }
@@ -73,8 +82,25 @@ public:
     bool useAutostart() const { return useAutostart_; }
     void setUseAutostart(bool autostart) { useAutostart_ = autostart; }
 
+    bool volumeFeedback() const { return volumeFeedback_; }
+    void setVolumeFeedback(bool feedback) { volumeFeedback_ = feedback; }
+
     QString mixerCommand() const { return mixerCommand_; }
     void setMixerCommand(const QString& command) { mixerCommand_ = command; }
+
+    // Device keys (see AudioDevice::key()) each shown as an additional tray item
+    QStringList extraDevices() const { return extraDevices_; }
+    void setExtraDevices(const QStringList& keys) { extraDevices_ = keys; }
+
+    // Run the engine in a helper process, read at startup only. The helper
+    // proxies volumes, mute and devices only: the PulseAudio card profiles,
+    // ports, stream list and stream meters are not shown then.
+    bool useEngineHelper() const { return useEngineHelper_; }
+    void setUseEngineHelper(bool helper) { useEngineHelper_ = helper; }
+
+    // Milliseconds a script hook may run before it gets disabled
+    int hookBudget() const { return hookBudget_; }
+    void setHookBudget(int msec) { hookBudget_ = msec; }
 #if 0
     bool ignoreMaxVolume() const { return ignoreMaxVolume_; }
     void setIgnoreMaxVolume(bool ignore) { ignoreMaxVolume_ = ignore; }
@@ -92,6 +118,7 @@ public:
 private:
     int engineId_;
     int channelId_;
+    int hookBudget_;
     int volume_;
     double pageStep_;
     double singleStep_;
@@ -105,6 +132,10 @@ private:
     bool showOnLeftClick_;
 #endif
     bool useAutostart_;
+    bool useEngineHelper_;
+    bool volumeFeedback_;
     QString mixerCommand_;
+    QStringList extraDevices_;
+    QVariantMap systemValues_; // merged system and drop-in layers
 };
 } // namespace azd
@@ -0,0 +1,450 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "trayitem.hpp"
+#include "application.hpp"
+#include "menuvolume.hpp"
+#include "viewthrottle.hpp"
+
+#include "audio/device.hpp"
+#include "audio/dispatcher.hpp"
+#include "audio/engine.hpp"
+#if USE_PULSEAUDIO
+#include "audio/engine/pulseaudio.hpp"
+#endif
+
+#if QT_VERSION < 0x060000
+    #include <StatusNotifierItemQt5/statusnotifieritem.h>
+#else
+    #include <StatusNotifierItemQt6/statusnotifieritem.h>
+#endif
+
+#include <QAction>
+#include <QMenu>
+#include <QToolTip>
+#include <QDebug>
+
+#include <algorithm>
+
+Qtilities::TrayItem::TrayItem(const QString &id, const QList<QAction *> &actions, QObject *parent)
+    : QObject(parent)
+    , trayIcon_(new StatusNotifierItem(id, this))
+    , mnuVolume_(new MenuVolume)
+    , viewThrottle_(new ViewThrottle(this))
+    , device_(nullptr)
+    , volumeCommitPending_(false)
+{
+    trayIcon_->setCategory(StatusNotifierItem::SNICategory::ApplicationStatus);
+    trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
+    trayIcon_->setToolTipTitle(qApp->applicationDisplayName());
+
+    mnuVolume_->loadSettings();
+    mnuVolume_->show(); // FIXME: crash without this
+    mnuVolume_->hide();
+
+    // Actions are shared between all the tray items, only the menu is per item
+    QMenu *mnuActions = new QMenu(mnuVolume_);
+    mnuActions->addActions(actions);
+    trayIcon_->setContextMenu(mnuActions);
+
+    connect(qApp, &QApplication::aboutToQuit, mnuVolume_, &QObject::deleteLater);
+    connect(qApp, &QApplication::aboutToQuit, trayIcon_, &QObject::deleteLater);
+    // Debug output only, tells how much the view throttle saved
+    connect(qApp, &QApplication::aboutToQuit, this, [this, id]() {
+        if (droppedUpdates() > 0)
+            qDebug("%s: %llu device updates merged into a later frame", qPrintable(id),
+                   static_cast<unsigned long long>(droppedUpdates()));
+    });
+
+    rebindTimer_.setSingleShot(true);
+    rebindTimer_.setInterval(5000);
+    connect(&rebindTimer_, &QTimer::timeout, this, [this]() { disconnect(rebindConnection_); });
+
+    connect(mnuVolume_, &MenuVolume::sigRunMixer, this, &TrayItem::sigRunMixer);
+    connect(mnuVolume_, &MenuVolume::sigMuteToggled, this, &TrayItem::commitMute);
+    connect(mnuVolume_, &MenuVolume::sigVolumeChanged, this, &TrayItem::commitVolume);
+    connect(mnuVolume_, &MenuVolume::sigPortSelected, this, &TrayItem::setPort);
+    connect(mnuVolume_, &MenuVolume::sigProfileSelected, this, &TrayItem::setCardProfile);
+    connect(mnuVolume_, &QMenu::aboutToShow, this, &TrayItem::updateCardMenus);
+    connect(mnuVolume_, &QMenu::aboutToShow, this, &TrayItem::startStreamList);
+    connect(mnuVolume_, &QMenu::aboutToHide, this, [this]() {
+        stopStreamList();
+        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
+    });
+    connect(viewThrottle_, &ViewThrottle::update, this, [this]() {
+        QPointer<TrayItem> self(this);
+        AudioDispatcher::instance()->post(AudioDispatcher::View, this, 0, [self]() {
+            if (self)
+                self->updateView();
+        });
+    });
+    connect(trayIcon_, &StatusNotifierItem::activateRequested, this, &TrayItem::onActivateRequested);
+    connect(trayIcon_, &StatusNotifierItem::secondaryActivateRequested, this, &TrayItem::onSecondaryActivateRequested);
+    connect(trayIcon_, &StatusNotifierItem::scrollRequested, this, &TrayItem::onScrollRequested);
+}
+
+void Qtilities::TrayItem::setDevice(AudioDevice *device)
+{
+    // device_ may already be null because its device got deleted, the view
+    // still shows that device then
+    if (device && device_ == device)
+        return;
+
+    if (device_) {
+        disconnect(device_, nullptr, this, nullptr);
+        disconnect(device_, nullptr, viewThrottle_, nullptr);
+        disconnect(device_, nullptr, trayIcon_, nullptr);
+    }
+
+    device_ = device;
+    disconnect(rebindConnection_);
+    rebindTimer_.stop();
+    volumeCommit_.reset();
+    volumeCommitPending_ = false;
+
+    if (device_) {
+        if (AudioEngine* engine = device_->engine())
+            engine->useDevice(device_);
+
+        mnuVolume_->setMute(device_->mute());
+        mnuVolume_->setVolume(device_->volume());
+        mnuVolume_->setStatus(statusText());
+        trayIcon_->setToolTipSubTitle(toolTipText());
+
+        // The device always holds the exact value, the view catches up once per frame
+        connect(device_, &AudioDevice::muteChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &AudioDevice::volumeChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &AudioDevice::stateChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &AudioDevice::boundChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &AudioDevice::descriptionChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &AudioDevice::healthChanged, viewThrottle_, &ViewThrottle::request);
+        connect(device_, &QObject::destroyed, this, [this]() { setDevice(nullptr); });
+    } else {
+        mnuVolume_->setStatus(QString());
+        trayIcon_->setToolTipSubTitle(tr("No device"));
+    }
+    updateIcon();
+}
+
+// The device model follows user input right away, the backend commit is queued
+// ahead of any backend work and a burst of input is merged into one commit.
+void Qtilities::TrayItem::commitVolume(int volume)
+{
+    if (!device_ || device_->volume() == volume)
+        return;
+
+    device_->setVolumeNoCommit(volume);
+    scheduleVolumeCommit();
+}
+
+// At most one volume commit is in flight, input arriving meanwhile
+// (e.g. a held media key) is folded into the next one.
+void Qtilities::TrayItem::scheduleVolumeCommit()
+{
+    if (volumeCommit_ && volumeCommit_->isRunning()) {
+        volumeCommitPending_ = true;
+        return;
+    }
+    QPointer<TrayItem> self(this);
+    QPointer<AudioDevice> device = device_;
+    AudioDispatcher::instance()->post(AudioDispatcher::UserIntent, device.data(), 0, [self, device]() {
+        if (!self || !device || !device->engine() || device != self->device_)
+            return;
+
+        self->volumeCommit_ = device->engine()->commitDeviceVolumeAsync(device);
+        self->volumeCommit_->onCompleted([self](const AudioOperation &) {
+            if (self && self->volumeCommitPending_) {
+                self->volumeCommitPending_ = false;
+                self->scheduleVolumeCommit();
+            }
+        });
+    });
+}
+
+void Qtilities::TrayItem::stepVolume(int steps)
+{
+    if (!device_)
+        return;
+
+    Settings &settings = static_cast<Application *>(qApp)->settings();
+    const int step = std::max(1, qRound(settings.singleStep()));
+    commitVolume(std::clamp(device_->volume() + steps * step, 0, 100));
+    device_->engine()->playFeedback(device_);
+}
+
+void Qtilities::TrayItem::toggleMute()
+{
+    if (device_)
+        commitMute(!device_->mute());
+}
+
+void Qtilities::TrayItem::commitMute(bool muted)
+{
+    if (!device_ || device_->mute() == muted)
+        return;
+
+    device_->setMuteNoCommit(muted);
+
+    QPointer<AudioDevice> device = device_;
+    AudioDispatcher::instance()->post(AudioDispatcher::UserIntent, device.data(), 1, [device, muted]() {
+        if (device && device->engine())
+            device->engine()->setMute(device, muted);
+    });
+}
+
+// Filled from the engine cache, opening the popup costs no server round-trip
+void Qtilities::TrayItem::updateCardMenus()
+{
+    QList<MenuVolume::Choice> profiles, ports;
+    QString activeProfile, activePort;
+#if USE_PULSEAUDIO
+    PulseAudioEngine *pulse = device_ ? qobject_cast<PulseAudioEngine *>(device_->engine()) : nullptr;
+    if (pulse) {
+        if (const PulseAudioCard *card = pulse->cardOf(device_)) {
+            for (const PulseAudioChoice &profile : card->profiles)
+                profiles.append(MenuVolume::Choice {profile.name, profile.description, profile.available});
+            activeProfile = card->activeProfile;
+        }
+        if (const PulseAudioSinkPorts *sinkPorts = pulse->portsOf(device_)) {
+            for (const PulseAudioChoice &port : sinkPorts->ports)
+                ports.append(MenuVolume::Choice {port.name, port.description, port.available});
+            activePort = sinkPorts->activePort;
+        }
+    }
+#endif
+    mnuVolume_->setProfiles(profiles, activeProfile);
+    mnuVolume_->setPorts(ports, activePort);
+}
+
+// Stream meters only run while the popup shows them
+void Qtilities::TrayItem::startStreamList()
+{
+#if USE_PULSEAUDIO
+    PulseAudioEngine *pulse = device_ ? qobject_cast<PulseAudioEngine *>(device_->engine()) : nullptr;
+    if (!pulse || streamsEngine_)
+        return;
+
+    streamsEngine_ = pulse;
+    streamsConnection_ = connect(pulse, &PulseAudioEngine::streamLevelsChanged, this, &TrayItem::updateStreamList);
+    pulse->startStreamMeters();
+    updateStreamList();
+#endif
+}
+
+void Qtilities::TrayItem::stopStreamList()
+{
+#if USE_PULSEAUDIO
+    disconnect(streamsConnection_);
+    if (PulseAudioEngine *pulse = qobject_cast<PulseAudioEngine *>(streamsEngine_.data()))
+        pulse->stopStreamMeters();
+
+    streamsEngine_.clear();
+#endif
+    mnuVolume_->setStreams({});
+}
+
+void Qtilities::TrayItem::updateStreamList()
+{
+    QList<MenuVolume::Stream> streams;
+#if USE_PULSEAUDIO
+    if (PulseAudioEngine *pulse = qobject_cast<PulseAudioEngine *>(streamsEngine_.data())) {
+        for (const PulseAudioStream &stream : pulse->streams())
+            streams.append(MenuVolume::Stream {stream.name, qBound(0, qRound(stream.level * 100), 100)});
+    }
+#endif
+    mnuVolume_->setStreams(streams);
+}
+
+void Qtilities::TrayItem::setPort(const QString &port)
+{
+#if USE_PULSEAUDIO
+    PulseAudioEngine *pulse = device_ ? qobject_cast<PulseAudioEngine *>(device_->engine()) : nullptr;
+    if (!pulse)
+        return;
+
+    // The sink stays the same, only its active port changes
+    pulse->setSinkPort(device_, port)->onCompleted([](const AudioOperation &op) {
+        if (!op.isFinished())
+            qWarning() << "Unable to switch port:" << op.errorString();
+    });
+#else
+    Q_UNUSED(port)
+#endif
+}
+
+void Qtilities::TrayItem::setCardProfile(const QString &profile)
+{
+#if USE_PULSEAUDIO
+    PulseAudioEngine *pulse = device_ ? qobject_cast<PulseAudioEngine *>(device_->engine()) : nullptr;
+    const PulseAudioCard *card = pulse ? pulse->cardOf(device_) : nullptr;
+    if (!card)
+        return;
+
+    // a newer switch replaces the one still waiting for its sink
+    disconnect(rebindConnection_);
+    rebindTimer_.stop();
+
+    uint32_t cardIndex = card->index;
+    // The sink index, the pointer may be reused once the old sink is deleted
+    uint previousSink = device_->index();
+    QPointer<TrayItem> self(this);
+    QPointer<PulseAudioEngine> engine(pulse);
+
+    pulse->setCardProfile(cardIndex, profile)->onCompleted([self, engine, cardIndex, previousSink](const AudioOperation &op) {
+        if (!self || !engine)
+            return;
+
+        if (!op.isFinished()) {
+            qWarning() << "Unable to switch card profile:" << op.errorString();
+            return;
+        }
+        // The card sink is replaced by a new one, whose events usually arrive
+        // after this reply: wait for a sink of the card other than the old one
+        auto rebind = [self, engine, cardIndex, previousSink]() {
+            AudioDevice *sink = engine->sinkOfCard(cardIndex);
+            if (!sink || sink->index() == previousSink)
+                return false;
+
+            disconnect(self->rebindConnection_);
+            self->rebindTimer_.stop();
+            emit self->sigDeviceReplaced(sink);
+            return true;
+        };
+        if (!rebind()) {
+            self->rebindConnection_ = connect(engine.data(), &AudioEngine::sinkListChanged, self.data(), rebind);
+            self->rebindTimer_.start();
+        }
+    });
+#else
+    Q_UNUSED(profile)
+#endif
+}
+
+QString Qtilities::TrayItem::stateText(AudioDevice::State state) const
+{
+    switch (state) {
+    case AudioDevice::Running:
+        return tr("Running");
+    case AudioDevice::Idle:
+        return tr("Idle");
+    case AudioDevice::Suspended:
+        return tr("Suspended");
+    case AudioDevice::Unknown:
+        break;
+    }
+    return QString();
+}
+
+// The engine helper reads a newly used device asynchronously
+QString Qtilities::TrayItem::statusText() const
+{
+    if (!device_->isBound())
+        return tr("Loading");
+
+    return stateText(device_->state());
+}
+
+QString Qtilities::TrayItem::toolTipText() const
+{
+    QString text = device_->description();
+    const AudioHealth &health = device_->health();
+    if (health.isEmpty())
+        return text;
+
+    const AudioHealthSample &sample = health.last();
+    text += QLatin1Char('\n')
+            + tr("Latency: %1 ms (configured %2 ms, peak %3 ms)")
+                  .arg(sample.latency / 1000.0, 0, 'f', 1)
+                  .arg(sample.configuredLatency / 1000.0, 0, 'f', 1)
+                  .arg(health.maxLatency() / 1000.0, 0, 'f', 1);
+    if (sample.xruns > 0)
+        text += QLatin1Char('\n') + tr("Xruns: %1").arg(sample.xruns);
+
+    return text;
+}
+
+quint64 Qtilities::TrayItem::droppedUpdates() const
+{
+    return viewThrottle_->dropped();
+}
+
+void Qtilities::TrayItem::updateView()
+{
+    if (!device_)
+        return;
+
+    mnuVolume_->setMute(device_->mute());
+    mnuVolume_->setVolume(device_->volume());
+    mnuVolume_->setStatus(statusText());
+    trayIcon_->setToolTipSubTitle(toolTipText());
+    updateIcon();
+}
+
+void Qtilities::TrayItem::updateIcon()
+{
+    QString iconName;
+    int volume = device_ ? device_->volume() : 0;
+    if (volume <= 0 || !device_ || device_->mute())
+        iconName = QLatin1String("audio-volume-muted");
+    else if (volume <= 33)
+        iconName = QLatin1String("audio-volume-low");
+    else if (volume <= 66)
+        iconName = QLatin1String("audio-volume-medium");
+    else
+        iconName = QLatin1String("audio-volume-high");
+
+    trayIcon_->setIconByName(iconName);
+}
+
+// Microphone in use indicator, an overlay so the volume icon stays readable
+void Qtilities::TrayItem::setRecording(int streams)
+{
+    trayIcon_->setOverlayIconByName(streams > 0 ? QLatin1String("audio-input-microphone") : QString());
+}
+
+void Qtilities::TrayItem::onActivateRequested(const QPoint&)
+{
+    if (trayIcon_->status() == StatusNotifierItem::SNIStatus::Active) {
+        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Passive);
+        mnuVolume_->hide();
+    } else {
+        trayIcon_->setStatus(StatusNotifierItem::SNIStatus::Active);
+        mnuVolume_->show();
+        mnuVolume_->adjustSize();
+        mnuVolume_->popUp();
+    }
+}
+
+void Qtilities::TrayItem::onSecondaryActivateRequested(const QPoint&)
+{
+    Settings &settings = static_cast<Application *>(qApp)->settings();
+    if (device_ && settings.muteOnMiddleClick())
+        commitMute(!device_->mute());
+}
+
+void Qtilities::TrayItem::onScrollRequested(int delta, Qt::Orientation)
+{
+    if (!device_)
+        return;
+    int v = std::clamp(device_->volume() + delta / 120, 0, 100);
+    commitVolume(v);
+    device_->engine()->playFeedback(device_);
+    QToolTip::showText(QCursor::pos(), QString("%1\%").arg(v));
+    QToolTip::hideText();
+}
@@ -0,0 +1,95 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include "audio/device.hpp"
+#include "audio/operation.hpp"
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+class StatusNotifierItem;
+
+QT_BEGIN_NAMESPACE
+class QAction;
+class QPoint;
+QT_END_NAMESPACE
+
+namespace Qtilities {
+
+class MenuVolume;
+class ViewThrottle;
+class TrayItem : public QObject
+{
+    Q_OBJECT
+
+public:
+    TrayItem(const QString &id, const QList<QAction *> &actions, QObject *parent = nullptr);
+
+    AudioDevice *device() const { return device_; }
+    void setDevice(AudioDevice *);
+
+    MenuVolume *menu() const { return mnuVolume_; }
+    void updateIcon();
+    void setRecording(int streams);
+    // Same path as scrolling, used by the global media keys
+    void stepVolume(int steps);
+    void toggleMute();
+    // Device changes not shown because a newer one arrived within the same frame
+    quint64 droppedUpdates() const;
+
+signals:
+    void sigRunMixer();
+    // The bound device went away and was replaced, e.g. after a card profile switch
+    void sigDeviceReplaced(AudioDevice *);
+
+private:
+    void onActivateRequested(const QPoint &);
+    void onSecondaryActivateRequested(const QPoint &);
+    void onScrollRequested(int delta, Qt::Orientation);
+    void commitMute(bool);
+    void commitVolume(int);
+    void scheduleVolumeCommit();
+    void setCardProfile(const QString &);
+    void setPort(const QString &);
+    void updateCardMenus();
+    void startStreamList();
+    void stopStreamList();
+    void updateStreamList();
+    void updateView();
+    QString stateText(AudioDevice::State state) const;
+    QString statusText() const;
+    QString toolTipText() const;
+
+    StatusNotifierItem *trayIcon_;
+    MenuVolume *mnuVolume_;
+    ViewThrottle *viewThrottle_;
+    QPointer<AudioDevice> device_;
+    QMetaObject::Connection rebindConnection_;
+    // Gives up waiting for the sink of a new profile, it may have none
+    QTimer rebindTimer_;
+    // Engine metering the streams while the popup is shown
+    QPointer<AudioEngine> streamsEngine_;
+    QMetaObject::Connection streamsConnection_;
+    AudioOperationPtr volumeCommit_;
+    bool volumeCommitPending_;
+};
+} // namespace Qtilities
@@ -0,0 +1,64 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "viewthrottle.hpp"
+
+#include <QGuiApplication>
+#include <QScreen>
+
+#include <cmath>
+
+Qtilities::ViewThrottle::ViewThrottle(QObject *parent)
+    : QObject(parent)
+    , pending_(false)
+    , dropped_(0)
+{
+    qreal refreshRate = 60.0;
+    if (const QScreen *screen = QGuiApplication::primaryScreen()) {
+        if (screen->refreshRate() > 1.0)
+            refreshRate = screen->refreshRate();
+    }
+    timer_.setTimerType(Qt::PreciseTimer);
+    timer_.setInterval(static_cast<int>(std::ceil(1000.0 / refreshRate)));
+
+    connect(&timer_, &QTimer::timeout, this, &ViewThrottle::onFrame);
+}
+
+void Qtilities::ViewThrottle::request()
+{
+    if (!timer_.isActive()) {
+        timer_.start();
+        emit update();
+        return;
+    }
+    if (pending_)
+        ++dropped_;
+
+    pending_ = true;
+}
+
+void Qtilities::ViewThrottle::onFrame()
+{
+    if (!pending_) {
+        timer_.stop();
+        return;
+    }
+    pending_ = false;
+    emit update();
+}
@@ -0,0 +1,52 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+
+namespace Qtilities {
+
+// Coalesces view refreshes to at most one per display frame.
+// The first request is delivered right away, requests arriving within the same
+// frame are merged into a single trailing update, so the view always ends up
+// showing the last model value.
+class ViewThrottle : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ViewThrottle(QObject *parent = nullptr);
+
+    void request();
+    // Intermediate requests merged into another update
+    quint64 dropped() const { return dropped_; }
+
+signals:
+    void update();
+
+private:
+    void onFrame();
+
+    QTimer timer_;
+    bool pending_;
+    quint64 dropped_;
+};
+} // namespace Qtilities
@@ -0,0 +1,162 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/device/alsa.hpp"
+#include "audio/engine/alsa.hpp"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QProcess>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+// Startup time and RSS of the ALSA engine with a card made large by user
+// controls, e.g. snd-dummy ("modprobe snd-dummy"), against loading the card
+// simple mixer as the engine did for every card before. Each figure comes
+// from its own process, started again with "--engine <card>" or
+// "--mixer <card>", so the RSS deltas don't mix. Run by hand:
+//     bench_alsa <card number> [user controls, default 2000]
+namespace {
+
+constexpr int DefaultControls = 2000;
+const char ControlName[] = "Bench Matrix %d Gain";
+
+long residentKb()
+{
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.value(1).toLong() * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void report(const char* name, const QElapsedTimer& timer, long rssBefore)
+{
+    std::printf("%-14s %8.2f ms  RSS %+6ld kB\n", name, timer.nsecsElapsed() / 1e6, residentKb() - rssBefore);
+}
+
+QByteArray hwName(int card)
+{
+    return QByteArrayLiteral("hw:") + QByteArray::number(card);
+}
+
+// Adds or removes the user controls making the card large
+bool setUpControls(int card, int count, bool add)
+{
+    snd_ctl_t* ctl;
+    if (snd_ctl_open(&ctl, hwName(card).constData(), 0) < 0)
+        return false;
+
+    snd_ctl_elem_id_t* id;
+    snd_ctl_elem_id_alloca(&id);
+    snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+    bool ok = true;
+    for (int i = 0; i < count && ok; ++i) {
+        char name[64];
+        std::snprintf(name, sizeof(name), ControlName, i);
+        snd_ctl_elem_id_set_name(id, name);
+        if (add)
+            ok = snd_ctl_elem_add_integer(ctl, id, 2, 0, 127, 1) >= 0;
+        else
+            snd_ctl_elem_remove(ctl, id);
+    }
+    snd_ctl_close(ctl);
+    return ok;
+}
+
+int runEngine(int card)
+{
+    long rss = residentKb();
+    QElapsedTimer timer;
+    timer.start();
+    AlsaEngine engine;
+    report("engine start", timer, rss);
+
+    AudioDevice* device = nullptr;
+    for (AudioDevice* dev : engine.sinks()) {
+        if (dev->index() == static_cast<uint>(card)) {
+            device = dev;
+            break;
+        }
+    }
+    if (!device) {
+        std::fprintf(stderr, "card %d has no playback volume\n", card);
+        return 1;
+    }
+    rss = residentKb();
+    timer.start();
+    engine.useDevice(device);
+    report("first use", timer, rss);
+    return 0;
+}
+
+int runMixer(int card)
+{
+    const long rss = residentKb();
+    QElapsedTimer timer;
+    timer.start();
+    snd_mixer_t* mixer;
+    if (snd_mixer_open(&mixer, 0) < 0 || snd_mixer_attach(mixer, hwName(card).constData()) < 0
+        || snd_mixer_selem_register(mixer, nullptr, nullptr) < 0 || snd_mixer_load(mixer) < 0)
+        return 1;
+
+    report("mixer load", timer, rss);
+    snd_mixer_close(mixer);
+    return 0;
+}
+
+bool runChild(const char* mode, int card)
+{
+    QProcess child;
+    child.setProcessChannelMode(QProcess::ForwardedChannels);
+    child.start(QCoreApplication::applicationFilePath(), { QString::fromLatin1(mode), QString::number(card) });
+    return child.waitForFinished(60000) && child.exitCode() == 0;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (argc == 3 && std::strcmp(argv[1], "--engine") == 0)
+        return runEngine(std::atoi(argv[2]));
+    if (argc == 3 && std::strcmp(argv[1], "--mixer") == 0)
+        return runMixer(std::atoi(argv[2]));
+
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <card number> [user controls]\n", argv[0]);
+        return 1;
+    }
+    const int card = std::atoi(argv[1]);
+    const int controls = argc > 2 ? std::atoi(argv[2]) : DefaultControls;
+    if (!setUpControls(card, controls, true)) {
+        std::fprintf(stderr, "cannot add %d controls to card %d\n", controls, card);
+        setUpControls(card, controls, false);
+        return 1;
+    }
+    std::printf("card %d with %d more controls\n", card, controls);
+    const bool ok = runChild("--engine", card) && runChild("--mixer", card);
+    setUpControls(card, controls, false);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/engine/pulseaudio.hpp"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QProcess>
+#include <QSet>
+#include <QTimer>
+
+#include <pulse/mainloop.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+
+// CPU cost of the stream level meters with 1, 10 and 50 playing streams.
+// The streams play a quiet tone from the benchmark started again with
+// "--play <count>", so the figures only hold the engine, its mainloop
+// thread and the meters. Each run is measured with the meters started,
+// then stopped. Needs a running PulseAudio (or pipewire-pulse) server.
+namespace {
+
+constexpr int Seconds = 10;
+constexpr int SampleRate = 44100;
+
+struct Player {
+    unsigned long frame = 0;
+};
+
+void playerWriteCallback(pa_stream* stream, size_t nbytes, void* userdata)
+{
+    Player* player = static_cast<Player*>(userdata);
+    void* data;
+    if (pa_stream_begin_write(stream, &data, &nbytes) < 0 || !data)
+        return;
+
+    // 440 Hz at -20 dBFS
+    float* samples = static_cast<float*>(data);
+    for (size_t i = 0; i < nbytes / sizeof(float); ++i, ++player->frame)
+        samples[i] = 0.1f * std::sin(2.0 * M_PI * 440.0 * player->frame / SampleRate);
+
+    pa_stream_write(stream, data, nbytes, nullptr, 0, PA_SEEK_RELATIVE);
+}
+
+struct Players {
+    int count;
+    Player* players;
+};
+
+void playerContextCallback(pa_context* context, void* userdata)
+{
+    if (pa_context_get_state(context) != PA_CONTEXT_READY)
+        return;
+
+    static const pa_sample_spec spec = { PA_SAMPLE_FLOAT32NE, SampleRate, 1 };
+    Players* players = static_cast<Players*>(userdata);
+    for (int i = 0; i < players->count; ++i) {
+        pa_stream* stream = pa_stream_new(context, "Benchmark tone", &spec, nullptr);
+        pa_stream_set_write_callback(stream, playerWriteCallback, &players->players[i]);
+        pa_stream_connect_playback(stream, nullptr, nullptr, PA_STREAM_NOFLAGS, nullptr, nullptr);
+    }
+}
+
+// Plays count streams until killed
+int runPlayers(int count)
+{
+    pa_mainloop* mainloop = pa_mainloop_new();
+    pa_context* context = pa_context_new(pa_mainloop_get_api(mainloop), "bench_meters players");
+    Players players { count, new Player[count] };
+    pa_context_set_state_callback(context, playerContextCallback, &players);
+    if (pa_context_connect(context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0)
+        return 1;
+
+    int result = 0;
+    pa_mainloop_run(mainloop, &result);
+    return result;
+}
+
+double cpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void wait(int msec)
+{
+    QEventLoop loop;
+    QTimer::singleShot(msec, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+// Process CPU time over the run, in percent of one core, and the number of
+// streams that reported a level
+double measure(PulseAudioEngine* engine, int* metered)
+{
+    QSet<uint32_t> heard;
+    QMetaObject::Connection connection = QObject::connect(engine, &PulseAudioEngine::streamLevelsChanged, engine, [engine, &heard]() {
+        const QMap<uint32_t, PulseAudioStream>& streams = engine->streams();
+        for (auto it = streams.cbegin(); it != streams.cend(); ++it) {
+            if (it->level > 0.0f)
+                heard.insert(it.key());
+        }
+    });
+    const double start = cpuSeconds();
+    wait(Seconds * 1000);
+    const double used = cpuSeconds() - start;
+    QObject::disconnect(connection);
+
+    *metered = heard.count();
+    return used * 100.0 / Seconds;
+}
+
+bool run(PulseAudioEngine* engine, int count)
+{
+    QProcess players;
+    players.start(QCoreApplication::applicationFilePath(), { QStringLiteral("--play"), QString::number(count) });
+    if (!players.waitForStarted())
+        return false;
+
+    // listed by the engine once started, give the streams time to settle
+    engine->startStreamMeters();
+    wait(2000);
+    const int streams = engine->streams().count();
+    int metered;
+    const double on = measure(engine, &metered);
+    engine->stopStreamMeters();
+
+    int unused;
+    const double off = measure(engine, &unused);
+
+    players.kill();
+    players.waitForFinished();
+
+    std::printf("%2d streams  listed %2d  metered %2d  CPU off %5.2f %%  on %5.2f %%\n", count, streams,
+                metered, off, on);
+    return streams >= count;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && std::strcmp(argv[1], "--play") == 0)
+        return runPlayers(std::atoi(argv[2]));
+
+    QCoreApplication app(argc, argv);
+    PulseAudioEngine engine(&app);
+    if (!engine.ready()) {
+        QEventLoop loop;
+        QObject::connect(&engine, &PulseAudioEngine::readyChanged, &loop, &QEventLoop::quit);
+        QTimer::singleShot(5000, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    if (!engine.ready()) {
+        std::fprintf(stderr, "cannot connect to the PulseAudio server\n");
+        return 1;
+    }
+    bool ok = true;
+    for (int count : { 1, 10, 50 })
+        ok = run(&engine, count) && ok;
+
+    return ok ? 0 : 1;
+}
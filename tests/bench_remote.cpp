@@ -0,0 +1,167 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "audio/device.hpp"
+#include "audio/engine.hpp"
+#include "audio/engine/remote.hpp"
+#include "audio/operation.hpp"
+#include "audio/remoteprotocol.hpp"
+#include "helper/enginehost.hpp"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/mman.h>
+
+// Volume commit round trip, from commitDeviceVolumeAsync() to the operation
+// completion, with the engine in-process and behind RemoteEngine. Both sides
+// host the same engine, applying a volume costs nothing: what is left is the
+// dispatch, plus the shared rings, eventfd wakeups and helper event loop.
+// The benchmark is its own engine helper, RemoteEngine starts it again with
+// the helper arguments.
+namespace {
+
+constexpr int Iterations = 10000;
+
+class FakeEngine : public AudioEngine {
+public:
+    FakeEngine(QObject* parent)
+        : AudioEngine(parent)
+    {
+        AudioDevice* dev = new AudioDevice(Sink, this);
+        dev->setName(QStringLiteral("bench"));
+        dev->setDescription(QStringLiteral("Benchmark sink"));
+        m_sinks.append(dev);
+    }
+
+    int volumeMax(AudioDevice*) const override { return 100; }
+    int id() const override { return 0; }
+    void setNormalized(bool normalized) override { m_isNormalized = normalized; }
+    void commitDeviceVolume(AudioDevice*) override { }
+    void setMute(AudioDevice*, bool) override { }
+};
+
+// <engine id> <shm fd> <command fd> <event fd>, as for the real helper
+int runHost(QCoreApplication& app)
+{
+    const QStringList args = app.arguments();
+    int values[4];
+    bool valid = true;
+    for (int i = 0; valid && i < 4; ++i)
+        values[i] = args.at(i + 1).toInt(&valid);
+
+    if (!valid)
+        return 1;
+
+    void* memory = mmap(nullptr, sizeof(AudioRemote::SharedBlock), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, values[1], 0);
+    if (memory == MAP_FAILED)
+        return 1;
+
+    auto* block = static_cast<AudioRemote::SharedBlock*>(memory);
+    if (!block->isValid())
+        return 1;
+
+    FakeEngine engine(&app);
+    EngineHost host(&engine, block, values[2], values[3]);
+    return app.exec();
+}
+
+// Round trips in microseconds, one commit in flight at a time
+QVector<double> measure(AudioEngine* engine, AudioDevice* device)
+{
+    QVector<double> samples;
+    samples.reserve(Iterations);
+    QEventLoop loop;
+    QElapsedTimer timer;
+    for (int i = 0; i < Iterations; ++i) {
+        bool completed = false;
+        device->setVolumeNoCommit(i % 100);
+
+        timer.start();
+        AudioOperationPtr operation = engine->commitDeviceVolumeAsync(device);
+        operation->onCompleted([&completed, &loop](const AudioOperation&) {
+            completed = true;
+            loop.quit();
+        });
+        if (!completed)
+            loop.exec();
+
+        samples.append(timer.nsecsElapsed() / 1000.0);
+        if (!operation->isFinished()) {
+            std::fprintf(stderr, "commit failed: %s\n", qPrintable(operation->errorString()));
+            return {};
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+void report(const char* name, const QVector<double>& samples)
+{
+    if (samples.isEmpty())
+        return;
+
+    std::printf("%-12s median %8.2f us  p99 %8.2f us  max %8.2f us  (%d commits)\n", name,
+                samples.at(samples.count() / 2), samples.at(samples.count() * 99 / 100),
+                samples.last(), samples.count());
+}
+
+// The helper reports its devices asynchronously
+AudioDevice* waitForDevice(AudioEngine* engine)
+{
+    if (engine->sinks().isEmpty()) {
+        QEventLoop loop;
+        QObject::connect(engine, &AudioEngine::sinkListChanged, &loop, &QEventLoop::quit);
+        QTimer::singleShot(5000, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return engine->sinks().value(0);
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (app.arguments().count() == 5)
+        return runHost(app);
+
+    FakeEngine local(&app);
+    report("in-process", measure(&local, local.sinks().first()));
+
+    RemoteEngine remote(0, &app);
+    if (!remote.hasChannel()) {
+        std::fprintf(stderr, "cannot set up the engine helper channel\n");
+        return 1;
+    }
+    AudioDevice* device = waitForDevice(&remote);
+    if (!device) {
+        std::fprintf(stderr, "the engine helper reported no device\n");
+        return 1;
+    }
+    report("remote", measure(&remote, device));
+    return 0;
+}
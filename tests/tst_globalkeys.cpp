@@ -0,0 +1,183 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "globalkeys.hpp"
+
+#include <QSignalSpy>
+#include <QtTest>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+#include <cstdlib>
+
+// Media keys pressed through XTest, meant for a private X server (xvfb-run):
+// the test moves the XF86Audio keysyms onto unused keycodes of its own.
+namespace {
+
+// XF86XK_AudioRaiseVolume, XF86XK_AudioMute
+constexpr xcb_keysym_t RaiseVolume = 0x1008FF13;
+constexpr xcb_keysym_t Mute = 0x1008FF12;
+// Held long enough for the server autorepeat to kick in
+constexpr int HoldTime = 1500;
+} // namespace
+
+class TestGlobalKeys : public QObject {
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void heldMuteTogglesOnce();
+    void heldRaiseRepeats();
+    void regrabsAfterMappingChange();
+
+private:
+    void setKeysym(xcb_keycode_t keycode, xcb_keysym_t keysym);
+    void hold(xcb_keycode_t keycode, int msec);
+
+    xcb_connection_t* connection_ = nullptr;
+    int keysymsPerKeycode_ = 0;
+    // unused keycodes: raise, mute, then where mute moves to
+    QVector<xcb_keycode_t> keycodes_;
+};
+
+void TestGlobalKeys::initTestCase()
+{
+    connection_ = xcb_connect(nullptr, nullptr);
+    if (xcb_connection_has_error(connection_))
+        QSKIP("No X server, run the test through xvfb-run");
+
+    const xcb_query_extension_reply_t* xtest = xcb_get_extension_data(connection_, &xcb_test_id);
+    if (!xtest || !xtest->present)
+        QSKIP("The X server has no XTest extension");
+
+    const xcb_setup_t* setup = xcb_get_setup(connection_);
+    const xcb_keycode_t minKeycode = setup->min_keycode;
+    xcb_get_keyboard_mapping_reply_t* reply = xcb_get_keyboard_mapping_reply(
+        connection_, xcb_get_keyboard_mapping(connection_, minKeycode, setup->max_keycode - minKeycode + 1),
+        nullptr);
+    QVERIFY(reply);
+
+    const xcb_keysym_t* syms = xcb_get_keyboard_mapping_keysyms(reply);
+    const int count = xcb_get_keyboard_mapping_keysyms_length(reply);
+    keysymsPerKeycode_ = reply->keysyms_per_keycode;
+    for (int i = 0; keysymsPerKeycode_ > 0 && i < count && keycodes_.count() < 3; i += keysymsPerKeycode_) {
+        bool unused = true;
+        for (int j = 0; j < keysymsPerKeycode_; ++j)
+            unused = unused && syms[i + j] == XCB_NO_SYMBOL;
+        if (unused)
+            keycodes_.append(minKeycode + i / keysymsPerKeycode_);
+    }
+    std::free(reply);
+    QCOMPARE(keycodes_.count(), 3);
+
+    setKeysym(keycodes_.at(0), RaiseVolume);
+    setKeysym(keycodes_.at(1), Mute);
+
+    // the server repeats held keys only with autorepeat on
+    const quint32 autoRepeat = XCB_AUTO_REPEAT_MODE_ON;
+    xcb_change_keyboard_control(connection_, XCB_KB_AUTO_REPEAT_MODE, &autoRepeat);
+    xcb_flush(connection_);
+}
+
+void TestGlobalKeys::cleanupTestCase()
+{
+    if (!connection_)
+        return;
+
+    for (xcb_keycode_t keycode : qAsConst(keycodes_))
+        setKeysym(keycode, XCB_NO_SYMBOL);
+    xcb_disconnect(connection_);
+}
+
+void TestGlobalKeys::setKeysym(xcb_keycode_t keycode, xcb_keysym_t keysym)
+{
+    QVector<xcb_keysym_t> syms(keysymsPerKeycode_, XCB_NO_SYMBOL);
+    syms[0] = keysym;
+    xcb_change_keyboard_mapping(connection_, 1, keycode, keysymsPerKeycode_, syms.constData());
+    xcb_flush(connection_);
+}
+
+void TestGlobalKeys::hold(xcb_keycode_t keycode, int msec)
+{
+    xcb_test_fake_input(connection_, XCB_KEY_PRESS, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_flush(connection_);
+    QTest::qWait(msec);
+    xcb_test_fake_input(connection_, XCB_KEY_RELEASE, keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+    xcb_flush(connection_);
+    QTest::qWait(200);
+}
+
+// Autorepeat comes as release and press pairs, only the first press counts
+void TestGlobalKeys::heldMuteTogglesOnce()
+{
+    Qtilities::GlobalKeys keys;
+    QVERIFY(keys.isActive());
+    QSignalSpy muteSpy(&keys, &Qtilities::GlobalKeys::sigMuteToggled);
+    QSignalSpy stepSpy(&keys, &Qtilities::GlobalKeys::sigVolumeStep);
+
+    hold(keycodes_.at(1), HoldTime);
+    QCOMPARE(muteSpy.count(), 1);
+    QCOMPARE(stepSpy.count(), 0);
+
+    hold(keycodes_.at(1), 50);
+    QCOMPARE(muteSpy.count(), 2);
+}
+
+// Every repeat is one more step, the tray item folds them into its commits
+void TestGlobalKeys::heldRaiseRepeats()
+{
+    Qtilities::GlobalKeys keys;
+    QVERIFY(keys.isActive());
+    QSignalSpy muteSpy(&keys, &Qtilities::GlobalKeys::sigMuteToggled);
+    QSignalSpy stepSpy(&keys, &Qtilities::GlobalKeys::sigVolumeStep);
+
+    hold(keycodes_.at(0), HoldTime);
+    QVERIFY(stepSpy.count() > 1);
+    for (const QList<QVariant>& args : qAsConst(stepSpy))
+        QCOMPARE(args.at(0).toInt(), 1);
+    QCOMPARE(muteSpy.count(), 0);
+}
+
+// Moving XF86AudioMute to another keycode re-grabs it there
+void TestGlobalKeys::regrabsAfterMappingChange()
+{
+    Qtilities::GlobalKeys keys;
+    QVERIFY(keys.isActive());
+    QSignalSpy muteSpy(&keys, &Qtilities::GlobalKeys::sigMuteToggled);
+
+    setKeysym(keycodes_.at(1), XCB_NO_SYMBOL);
+    setKeysym(keycodes_.at(2), Mute);
+    // the MappingNotify has to reach GlobalKeys first
+    QTest::qWait(200);
+
+    hold(keycodes_.at(2), 50);
+    QCOMPARE(muteSpy.count(), 1);
+    hold(keycodes_.at(1), 50);
+    QCOMPARE(muteSpy.count(), 1);
+
+    setKeysym(keycodes_.at(2), XCB_NO_SYMBOL);
+    setKeysym(keycodes_.at(1), Mute);
+    QTest::qWait(200);
+}
+
+QTEST_GUILESS_MAIN(TestGlobalKeys)
+
+#include "tst_globalkeys.moc"
@@ -0,0 +1,129 @@
+/*
+    VolTrayke - Volume tray widget.
+    Copyright (C) 2021-2024 Andrea Zanellato <redtid3@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    SPDX-License-Identifier: GPL-2.0-only
+*/
+#include "application.hpp"
+#include "dialogprefs.hpp"
+#include "trayitem.hpp"
+
+#include "audio/device.hpp"
+#include "audio/engine.hpp"
+
+#include <QComboBox>
+#include <QDoubleSpinBox>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QtTest>
+
+namespace {
+
+class FakeDevice : public AudioDevice {
+public:
+    using AudioDevice::AudioDevice;
+
+    // every connection is one more handler run per change
+    int volumeHandlers() const { return receivers(SIGNAL(volumeChanged(int))); }
+    int muteHandlers() const { return receivers(SIGNAL(muteChanged(bool))); }
+};
+
+class FakeEngine : public AudioEngine {
+public:
+    FakeEngine(QObject* parent)
+        : AudioEngine(parent)
+    {
+        for (int i = 0; i < 2; ++i) {
+            FakeDevice* dev = new FakeDevice(Sink, this);
+            dev->setName(QStringLiteral("fake%1").arg(i));
+            dev->setDescription(QStringLiteral("Fake %1").arg(i));
+            m_sinks.append(dev);
+        }
+    }
+
+    int volumeMax(AudioDevice*) const override { return 100; }
+    int id() const override { return 0; }
+    void setNormalized(bool normalized) override { m_isNormalized = normalized; }
+    void commitDeviceVolume(AudioDevice*) override { }
+    void setMute(AudioDevice*, bool) override { }
+
+    FakeDevice* device(int index) const { return static_cast<FakeDevice*>(m_sinks.at(index)); }
+};
+} // namespace
+
+class TestPreferences : public QObject {
+    Q_OBJECT
+
+private slots:
+    void rebindIsIdempotent();
+};
+
+// Each visit accepts the dialog, some of them changing the step size or the
+// channel: whatever the number of visits, a bound device has one set of
+// handlers and an unbound one none.
+void TestPreferences::rebindIsIdempotent()
+{
+#if !USE_ALSA && !USE_PULSEAUDIO
+    QSKIP("The engine id can't be kept without any engine built in");
+#endif
+    auto* app = static_cast<Qtilities::Application*>(qApp);
+    app->onAudioEngineChanged(-1);
+
+    FakeEngine* engine = new FakeEngine(app);
+    app->engine_ = engine;
+    app->settings().setEngineId(engine->id());
+    app->settings().setChannelId(0);
+    app->onAudioDeviceChanged(0);
+    app->updateDeviceList();
+
+    const int boundVolume = engine->device(0)->volumeHandlers();
+    const int boundMute = engine->device(0)->muteHandlers();
+    const int unboundVolume = engine->device(1)->volumeHandlers();
+    const int unboundMute = engine->device(1)->muteHandlers();
+    QVERIFY(boundVolume > unboundVolume);
+
+    for (int visit = 0; visit < 100; ++visit) {
+        const int channel = (visit / 25) % 2;
+        QTimer::singleShot(0, app, [visit, channel]() {
+            auto* prefs = qobject_cast<Qtilities::DialogPrefs*>(QApplication::activeModalWidget());
+            QVERIFY(prefs);
+            prefs->findChild<QComboBox*>(QStringLiteral("cbxChannel"))->setCurrentIndex(channel);
+            if (visit % 3 == 0)
+                prefs->findChild<QDoubleSpinBox*>(QStringLiteral("sbxStep"))->setValue(1 + visit % 2);
+            prefs->accept();
+        });
+        app->preferences();
+
+        QCOMPARE(app->trayItems_.first()->device(), engine->device(channel));
+        QCOMPARE(engine->device(channel)->volumeHandlers(), boundVolume);
+        QCOMPARE(engine->device(channel)->muteHandlers(), boundMute);
+        QCOMPARE(engine->device(1 - channel)->volumeHandlers(), unboundVolume);
+        QCOMPARE(engine->device(1 - channel)->muteHandlers(), unboundMute);
+    }
+    // still applied, once
+    engine->device(1)->setVolumeNoCommit(42);
+    QCOMPARE(app->settings().volume(), 42);
+}
+
+int main(int argc, char* argv[])
+{
+    QStandardPaths::setTestModeEnabled(true);
+    Qtilities::Application app(argc, argv);
+    TestPreferences test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_preferences.moc"